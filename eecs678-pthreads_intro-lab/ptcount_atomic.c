@@ -1,9 +1,33 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #define NUM_THREADS  3
 
+/*
+ * Size of a cache line. Counters updated by different threads are
+ * kept this far apart so that no two of them share a line.
+ */
+#define CACHE_LINE   64
+
+/*
+ * Ways the threads can count:
+ *
+ * shared  - every thread atomically adds to the one global count
+ * packed  - every thread adds to its own slot of an int array, so the
+ *           slots are private but sit on the same cache line
+ * sharded - like packed, but every slot has a cache line to itself
+ *
+ * In the last two modes main adds up the slots after the join.
+ */
+enum count_mode { MODE_SHARED, MODE_PACKED, MODE_SHARDED };
+
+const char *mode_names[] = { "shared", "packed", "sharded" };
+
+#define NUM_MODES (sizeof(mode_names) / sizeof(mode_names[0]))
+
 typedef struct thread_args {
   int tid;
   int inc;
@@ -13,6 +37,19 @@ typedef struct thread_args {
 int count = 0;
 pthread_mutex_t count_mutex;
 
+enum count_mode mode = MODE_SHARED;
+
+/*
+ * Per-thread counters for the packed and sharded modes
+ */
+volatile int packed[NUM_THREADS];
+
+typedef struct {
+  _Alignas(CACHE_LINE) volatile int count;
+} padded_count;
+
+padded_count sharded[NUM_THREADS];
+
 /*
  * This routine will be executed by each thread we choose to create.
  * The routine a new thread will execute is given as an arguent to the
@@ -32,6 +69,8 @@ void *inc_count(void *arg)
      * existence and the need for Critical section protection?
      */
 
+    switch (mode) {
+    case MODE_SHARED:
     #ifdef __GNUC__
       __atomic_add_fetch(&count, my_args->inc, __ATOMIC_RELAXED); //count = count + my_args->inc;
     #else
@@ -39,6 +78,21 @@ void *inc_count(void *arg)
       count = count + my_args->inc;
       pthread_mutex_unlock(&count_mutex);
     #endif
+      break;
+
+    /*
+     * Only this thread writes its slot, so no atomic is needed. The
+     * volatile keeps the compiler from collapsing the loop into a
+     * single store, so the cache traffic of each add is measured.
+     */
+    case MODE_PACKED:
+      packed[my_args->tid] += my_args->inc;
+      break;
+
+    case MODE_SHARDED:
+      sharded[my_args->tid].count += my_args->inc;
+      break;
+    }
 
     loc = loc + my_args->inc;
   }
@@ -53,12 +107,29 @@ int main(int argc, char *argv[])
   struct thread_args *targs;
   pthread_t threads[NUM_THREADS];
   pthread_attr_t attr;
+  struct timespec start, end;
+  double elapsed;
 
-  if (argc != 3) {
-    printf("Usage: ./ptcount_atomic LOOP_BOUND INCREMENT\n");
+  if (argc != 3 && argc != 4) {
+    printf("Usage: ./ptcount_atomic LOOP_BOUND INCREMENT [shared|packed|sharded]\n");
     exit(0);
   }
 
+  /*
+   * The optional third argument picks how the threads count
+   */
+  if (argc == 4) {
+    for (i = 0; i < NUM_MODES; i++)
+      if (strcmp(argv[3], mode_names[i]) == 0)
+        break;
+
+    if (i == NUM_MODES) {
+      printf("Unknown mode %s\n", argv[3]);
+      exit(1);
+    }
+    mode = (enum count_mode) i;
+  }
+
   /*
    * First argument is how many times to loop. The second is how much
    * to increment each time.
@@ -73,6 +144,8 @@ int main(int argc, char *argv[])
   pthread_attr_init(&attr);
   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
 
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
   /* Create each thread using pthread_create.  The start routine for
    * each thread should be inc_count. The attribute object should be
    * attr. You should pass as the thread's sole argument the populated
@@ -96,6 +169,22 @@ int main(int argc, char *argv[])
     pthread_join(threads[i], NULL);
   }
 
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  /*
+   * Reduce the per-thread counters into the final count
+   */
+  for (i = 0; i < NUM_THREADS; i++) {
+    if (mode == MODE_PACKED)
+      count += packed[i];
+    else if (mode == MODE_SHARDED)
+      count += sharded[i].count;
+  }
+
+  elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("Mode %s: %.3f s, %.2f ns per increment\n", mode_names[mode],
+         elapsed, elapsed * 1e9 / ((double) loop * NUM_THREADS));
+
   printf ("Main(): Waited on %d threads. Final value of count = %d. Done.\n",
           NUM_THREADS, count);
 
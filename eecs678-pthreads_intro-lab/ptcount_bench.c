@@ -0,0 +1,340 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Size of a cache line, used to keep per-thread counters apart
+ */
+#define CACHE_LINE  64
+
+/*
+ * How many increments the thread-local strategy gathers before adding
+ * them to the shared counter
+ */
+#define FLUSH_INTERVAL 1024
+
+typedef struct thread_args {
+  int tid;
+  int inc;
+  int loop;
+  double start;   /* When this thread started counting */
+  double end;     /* When it finished */
+} thread_args;
+
+/*
+ * The counters and locks every strategy works on. Each strategy only
+ * touches its own fields, and each field group sits on its own cache
+ * line so one strategy's leftovers do not disturb the next run.
+ */
+struct {
+  _Alignas(CACHE_LINE) long count;
+  _Alignas(CACHE_LINE) atomic_long atomic_count;
+  _Alignas(CACHE_LINE) pthread_mutex_t mutex;
+  _Alignas(CACHE_LINE) pthread_spinlock_t spinlock;
+} shared;
+
+typedef struct {
+  _Alignas(CACHE_LINE) volatile long count;
+} padded_count;
+
+/*
+ * One counter per thread, sized for the largest run in main()
+ */
+padded_count *shards;
+
+/*
+ * Every thread waits here so they all start counting together
+ */
+pthread_barrier_t start_barrier;
+
+/*
+ * Current time in seconds
+ */
+double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Wait for the other threads and note when counting starts
+ */
+void begin(thread_args *my_args)
+{
+  pthread_barrier_wait(&start_barrier);
+  my_args->start = now();
+}
+
+/*
+ * The start routines, one per strategy. Each adds inc to its counter
+ * loop times.
+ */
+void *inc_mutex(void *arg)
+{
+  thread_args *my_args = (thread_args*) arg;
+  int i;
+
+  begin(my_args);
+  for (i = 0; i < my_args->loop; i++) {
+    pthread_mutex_lock(&shared.mutex);
+    shared.count = shared.count + my_args->inc;
+    pthread_mutex_unlock(&shared.mutex);
+  }
+  my_args->end = now();
+  return NULL;
+}
+
+void *inc_spinlock(void *arg)
+{
+  thread_args *my_args = (thread_args*) arg;
+  int i;
+
+  begin(my_args);
+  for (i = 0; i < my_args->loop; i++) {
+    pthread_spin_lock(&shared.spinlock);
+    shared.count = shared.count + my_args->inc;
+    pthread_spin_unlock(&shared.spinlock);
+  }
+  my_args->end = now();
+  return NULL;
+}
+
+void *inc_fetch_add(void *arg)
+{
+  thread_args *my_args = (thread_args*) arg;
+  int i;
+
+  begin(my_args);
+  for (i = 0; i < my_args->loop; i++)
+    atomic_fetch_add_explicit(&shared.atomic_count, my_args->inc,
+                              memory_order_relaxed);
+  my_args->end = now();
+  return NULL;
+}
+
+/*
+ * The way a read-modify-write is built when the hardware has no
+ * suitable atomic instruction: read, compute, and retry if another
+ * thread changed the counter in between
+ */
+void *inc_cas(void *arg)
+{
+  thread_args *my_args = (thread_args*) arg;
+  long old;
+  int i;
+
+  begin(my_args);
+  for (i = 0; i < my_args->loop; i++) {
+    old = atomic_load_explicit(&shared.atomic_count, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&shared.atomic_count,
+                                                  &old, old + my_args->inc,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+      ;
+  }
+  my_args->end = now();
+  return NULL;
+}
+
+/*
+ * Each thread owns a padded slot and main adds the slots up at the
+ * end. Only the owner writes a slot, so no atomic is needed.
+ */
+void *inc_sharded(void *arg)
+{
+  thread_args *my_args = (thread_args*) arg;
+  int i;
+
+  begin(my_args);
+  for (i = 0; i < my_args->loop; i++)
+    shards[my_args->tid].count += my_args->inc;
+  my_args->end = now();
+  return NULL;
+}
+
+/*
+ * Count in a local variable and only add it to the shared counter
+ * every FLUSH_INTERVAL increments and at the end
+ */
+void *inc_local_flush(void *arg)
+{
+  thread_args *my_args = (thread_args*) arg;
+  long loc = 0;
+  int i;
+
+  begin(my_args);
+  for (i = 0; i < my_args->loop; i++) {
+    loc = loc + my_args->inc;
+
+    if ((i + 1) % FLUSH_INTERVAL == 0) {
+      atomic_fetch_add_explicit(&shared.atomic_count, loc,
+                                memory_order_relaxed);
+      loc = 0;
+    }
+  }
+  atomic_fetch_add_explicit(&shared.atomic_count, loc, memory_order_relaxed);
+  my_args->end = now();
+  return NULL;
+}
+
+typedef struct strategy {
+  const char *name;
+  void *(*start)(void *);
+} strategy;
+
+strategy strategies[] = {
+  { "mutex",       inc_mutex },
+  { "spinlock",    inc_spinlock },
+  { "fetch_add",   inc_fetch_add },
+  { "cas",         inc_cas },
+  { "sharded",     inc_sharded },
+  { "local_flush", inc_local_flush },
+};
+
+#define NUM_STRATEGIES (sizeof(strategies) / sizeof(strategies[0]))
+
+/*
+ * Run one strategy with num_threads threads and return the elapsed
+ * time in seconds. The final count is checked against the expected
+ * total.
+ */
+double run(strategy *s, int num_threads, int loop, int inc)
+{
+  pthread_t *threads;
+  thread_args *targs;
+  double start, end;
+  long total;
+  int i;
+
+  threads = malloc(num_threads * sizeof(pthread_t));
+  targs = malloc(num_threads * sizeof(thread_args));
+  if (threads == NULL || targs == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+
+  shared.count = 0;
+  atomic_store(&shared.atomic_count, 0);
+  for (i = 0; i < num_threads; i++)
+    shards[i].count = 0;
+
+  pthread_barrier_init(&start_barrier, NULL, num_threads);
+
+  for (i = 0; i < num_threads; i++) {
+    targs[i].tid = i;
+    targs[i].loop = loop;
+    targs[i].inc = inc;
+    pthread_create(&threads[i], NULL, s->start, &targs[i]);
+  }
+
+  for (i = 0; i < num_threads; i++)
+    pthread_join(threads[i], NULL);
+
+  pthread_barrier_destroy(&start_barrier);
+
+  /*
+   * The run lasts from the first thread starting to count to the last
+   * one finishing, which leaves thread creation out of it
+   */
+  start = targs[0].start;
+  end = targs[0].end;
+  for (i = 1; i < num_threads; i++) {
+    if (targs[i].start < start)
+      start = targs[i].start;
+    if (targs[i].end > end)
+      end = targs[i].end;
+  }
+
+  total = shared.count + atomic_load(&shared.atomic_count);
+  for (i = 0; i < num_threads; i++)
+    total += shards[i].count;
+
+  if (total != (long) loop * inc * num_threads)
+    printf("%s with %d threads counted %ld, expected %ld\n", s->name,
+           num_threads, total, (long) loop * inc * num_threads);
+
+  free(threads);
+  free(targs);
+  return end - start;
+}
+
+int main(int argc, char *argv[])
+{
+  int i, j, loop, inc, max_threads;
+  double elapsed, base_rate, rate;
+  strategy *s;
+
+  if (argc < 3) {
+    printf("Usage: ./ptcount_bench LOOP_BOUND MAX_THREADS [STRATEGY...]\n");
+    printf("Strategies:");
+    for (i = 0; i < NUM_STRATEGIES; i++)
+      printf(" %s", strategies[i].name);
+    printf("\n");
+    exit(0);
+  }
+
+  /*
+   * First argument is how many times each thread increments. The
+   * second is the largest thread count to try, every count from one
+   * up to it is run. Any further arguments select strategies, by
+   * default all of them run.
+   */
+  loop = atoi(argv[1]);
+  max_threads = atoi(argv[2]);
+  inc = 1;
+
+  if (loop < 1 || max_threads < 1) {
+    printf("LOOP_BOUND and MAX_THREADS must be positive\n");
+    exit(1);
+  }
+
+  shards = aligned_alloc(CACHE_LINE, max_threads * sizeof(padded_count));
+  if (shards == NULL) {
+    perror("aligned_alloc");
+    exit(1);
+  }
+
+  pthread_mutex_init(&shared.mutex, NULL);
+  pthread_spin_init(&shared.spinlock, PTHREAD_PROCESS_PRIVATE);
+
+  /*
+   * ns/op is wall time per increment over all threads. Efficiency
+   * compares the throughput with N threads to N times the throughput
+   * of one, so 100% means perfect scaling.
+   */
+  printf("%-12s %7s %10s %10s %10s\n",
+         "strategy", "threads", "ns/op", "Mops/s", "efficiency");
+
+  for (i = 0; i < NUM_STRATEGIES; i++) {
+    s = &strategies[i];
+
+    if (argc > 3) {
+      for (j = 3; j < argc; j++)
+        if (strcmp(argv[j], s->name) == 0)
+          break;
+      if (j == argc)
+        continue;
+    }
+
+    base_rate = 0;
+    for (j = 1; j <= max_threads; j++) {
+      elapsed = run(s, j, loop, inc);
+      rate = (double) loop * j / elapsed;
+      if (j == 1)
+        base_rate = rate;
+
+      printf("%-12s %7d %10.2f %10.2f %9.1f%%\n", s->name, j,
+             1e9 / rate, rate / 1e6, 100.0 * rate / (base_rate * j));
+    }
+  }
+
+  pthread_spin_destroy(&shared.spinlock);
+  pthread_mutex_destroy(&shared.mutex);
+  free(shards);
+  return 0;
+}
@@ -0,0 +1,1361 @@
+/*
+ * Copies a file with one of several strategies and reports how fast
+ * it went. Usage:
+ *
+ *   mcopy [-m method] [-b buf_size] [-w window] [-d depth] [-t threads]
+ *         [-S] [-k] [-V] [-s] [-c] [-C] <fromfile> <tofile>
+ *
+ * Methods:
+ *   mmap      maps a sliding window of both files and memcpy()s it
+ *   rw        pread()/pwrite() through a user buffer
+ *   cfr       copy_file_range(), the kernel copies without the data
+ *             passing through user space and may share extents
+ *   sendfile  sendfile() from the input to the output
+ *   uring     io_uring with depth buffers of buf_size in flight
+ *   auto      picks by file size (the default)
+ *   all       runs every method in turn, to compare them
+ *
+ * A method that cannot be used on the given files, like io_uring on a
+ * kernel without it, falls back to rw. -t splits the file into that
+ * many ranges and copies them at once from separate threads.
+ *
+ * -S keeps the output as sparse as the input. Holes are found with
+ * SEEK_DATA and SEEK_HOLE and only the data between them is copied.
+ * mmap, rw and uring also look at the data itself and leave blocks
+ * that are all zeroes unwritten, so a file full of zeroes written out
+ * the long way still comes out sparse.
+ *
+ * -k takes a CRC32C of the data as mmap, rw and uring copy it, in the
+ * same pass, using the SSE4.2 crc32 instruction when the CPU has it.
+ * cfr and sendfile never see the data, so with -k they fall back to rw.
+ * -V checks the copy as well: the output is written back and dropped
+ * from the page cache, then read once and its CRC compared, so only
+ * the output is read again and never the input.
+ *
+ * Sizes take a k, m or g suffix. -s includes an fsync() of the output
+ * in the time, otherwise the time is until the data is in the page
+ * cache. -c drops the input from the page cache before each copy so it
+ * is read from the device. -C prints a CSV line per copy instead:
+ *
+ *   method,buf_size,window,depth,threads,cache,bytes,seconds,mb_per_s,syscalls,skipped,crc32c
+ *
+ * where skipped is how many bytes -S left as holes and crc32c is only
+ * filled in with -k.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * Defaults. 128 KiB is where read/write throughput levels off on most
+ * machines, and a 16 MiB window keeps mmap's setup and TLB costs small
+ * next to the copying.
+ */
+#define DEFAULT_BUF      (128 * 1024)
+#define DEFAULT_WINDOW   (16 * 1024 * 1024)
+#define DEFAULT_DEPTH    8
+
+/*
+ * auto copies files smaller than this with one read and one write,
+ * where the setup of any other method costs more than the copy
+ */
+#define SMALL_FILE       (1024 * 1024)
+
+/*
+ * The largest single copy_file_range() or sendfile() request
+ */
+#define KERNEL_CHUNK     (1024 * 1024 * 1024)
+
+/*
+ * Parallel copies cut the file on multiples of this
+ */
+#define SPLIT_ALIGN      (1024 * 1024)
+
+/*
+ * -S checks for zeroes a block at a time. Blocks are aligned to file
+ * offsets so they line up with the file system's own.
+ */
+#define ZERO_BLOCK       4096
+
+/*
+ * CRC32C, the Castagnoli polynomial, bit reflected
+ */
+#define CRC32C_POLY      0x82f63b78
+
+/*
+ * Enough powers x^(2^k) to shift a CRC past any 63 bit byte count
+ */
+#define CRC_X2N          67
+
+void err_quit (const char * mesg)
+{
+  printf ("%s\n", mesg);
+  exit(1);
+}
+
+void err_sys (const char * mesg)
+{
+  perror(mesg);
+  exit(errno);
+}
+
+/*
+ * One copy of the bytes [pos, end) of fdin to the same offsets of
+ * fdout. A method advances pos as it goes, so when it gives up part
+ * way another can carry on from there.
+ */
+typedef struct copyjob {
+  int    fdin;
+  int    fdout;
+  off_t  pos;
+  off_t  end;
+  size_t bufsz;
+  size_t window;
+  int    depth;
+  int    sparse;    /* -S */
+  int    checksum;  /* -k */
+  off_t  size;      /* Of the whole input, see sum_data() */
+  long   syscalls;
+  off_t  skipped;   /* Bytes left as holes rather than written */
+  uint32_t crc;
+} copyjob;
+
+/*
+ * Returns 0 once the range is copied, or -1 with errno set. errno is
+ * one of the unsupported() values when the method cannot be used on
+ * these files at all.
+ */
+typedef int (*copyfn) (copyjob *job);
+
+typedef struct method {
+  const char *name;
+  copyfn      copy;
+} method;
+
+/*
+ * How each copy is run and reported
+ */
+typedef struct runopts {
+  int sync;       /* -s */
+  int cold;       /* -c */
+  int csv;        /* -C */
+  int threads;    /* -t */
+  int verify;     /* -V */
+  const char *from;
+  const char *to;
+} runopts;
+
+int unsupported (int err)
+{
+  return err == ENOSYS || err == EXDEV || err == EINVAL ||
+         err == EOPNOTSUPP || err == ENODEV;
+}
+
+/*
+ * CRC32C. The raw CRC of a chunk, starting from 0 with no final
+ * inversion, is linear: the raw CRC of a whole file is the XOR of the
+ * raw CRCs of its chunks, each shifted by the number of bytes that
+ * follow it. So chunks can be summed in any order, by any thread, and
+ * added up at the end. Zeroes have a raw CRC of 0, which is why holes
+ * skipped by -S need no summing at all.
+ */
+uint32_t crc_table[256];
+uint32_t crc_x2n[CRC_X2N];
+int      crc_hw;
+
+/*
+ * a * b modulo the polynomial, in the reflected bit order
+ */
+uint32_t crc_mult (uint32_t a, uint32_t b)
+{
+  uint32_t m = 1u << 31, p = 0;
+
+  for (; m != 0; m >>= 1) {
+    if (a & m)
+      p ^= b;
+    b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+  }
+  return p;
+}
+
+void crc_init (void)
+{
+  uint32_t c;
+  int i, k;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (k = 0; k < 8; k++)
+      c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+    crc_table[i] = c;
+  }
+
+  crc_x2n[0] = 1u << 30;    /* x^1 */
+  for (i = 1; i < CRC_X2N; i++)
+    crc_x2n[i] = crc_mult(crc_x2n[i - 1], crc_x2n[i - 1]);
+
+#if defined(__x86_64__)
+  crc_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+/*
+ * What crc becomes after len more bytes of zeroes
+ */
+uint32_t crc_shift (uint32_t crc, off_t len)
+{
+  uint32_t p = 1u << 31;    /* x^0 */
+  int k;
+
+  for (k = 3; len > 0; len >>= 1, k++)
+    if (len & 1)
+      p = crc_mult(crc_x2n[k], p);
+  return crc_mult(p, crc);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t crc_update_hw (uint32_t crc, const char *p, size_t len)
+{
+  uint64_t c = crc, w;
+
+  for (; len >= 8; p += 8, len -= 8) {
+    memcpy(&w, p, 8);
+    c = __builtin_ia32_crc32di(c, w);
+  }
+  for (; len > 0; p++, len--)
+    c = __builtin_ia32_crc32qi(c, *p);
+  return c;
+}
+#endif
+
+uint32_t crc_update (uint32_t crc, const char *p, size_t len)
+{
+#if defined(__x86_64__)
+  if (crc_hw)
+    return crc_update_hw(crc, p, len);
+#endif
+  for (; len > 0; p++, len--)
+    crc = crc_table[(crc ^ *p) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+/*
+ * The CRC32C of a file of size bytes from the XOR of its chunks' raw
+ * CRCs. A CRC proper starts from all ones and inverts the result.
+ */
+uint32_t crc_final (uint32_t raw, off_t size)
+{
+  return ~(crc_shift(0xffffffff, size) ^ raw);
+}
+
+/*
+ * Add the len bytes at file offset off to the job's checksum, shifted
+ * to the end of the input
+ */
+void sum_data (copyjob *job, const char *buf, size_t len, off_t off)
+{
+  if (job->checksum)
+    job->crc ^= crc_shift(crc_update(0, buf, len), job->size - (off + len));
+}
+
+/*
+ * Is the block all zeroes? Once the first 16 bytes are known to be
+ * zero, the block is zero exactly when it equals itself shifted by 16,
+ * which memcmp() checks with the widest vector instructions the C
+ * library has for this machine.
+ */
+int is_zero (const char *p, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len && i < 16; i++)
+    if (p[i] != 0)
+      return 0;
+  return len <= 16 || memcmp(p, p + 16, len - 16) == 0;
+}
+
+/*
+ * Length of the zero check block starting at off, cut short at the
+ * next ZERO_BLOCK boundary or at end
+ */
+size_t zero_block (off_t off, off_t end)
+{
+  size_t len = ZERO_BLOCK - (off & (ZERO_BLOCK - 1));
+
+  if (off + len > end)
+    len = end - off;
+  return len;
+}
+
+/*
+ * Write all of buf at off, coping with short writes
+ */
+int write_all (copyjob *job, const char *buf, size_t len, off_t off)
+{
+  ssize_t put;
+  size_t done;
+
+  for (done = 0; done < len; done += put) {
+    put = pwrite(job->fdout, buf + done, len - done, off + done);
+    job->syscalls++;
+    if (put < 0 && errno == EINTR)
+      put = 0;
+    else if (put < 0)
+      return -1;
+  }
+  return 0;
+}
+
+/*
+ * Write buf at off, or with -S only its blocks that are not all zeroes.
+ * Neighbouring data blocks go out in one write.
+ */
+int write_data (copyjob *job, const char *buf, size_t len, off_t off)
+{
+  size_t at, run, blk;
+
+  if (!job->sparse)
+    return write_all(job, buf, len, off);
+
+  for (at = run = 0; at < len; at += blk) {
+    blk = zero_block(off + at, off + len);
+    if (!is_zero(buf + at, blk)) {
+      run += blk;
+      continue;
+    }
+    if (run > 0 && write_all(job, buf + at - run, run, off + at - run) < 0)
+      return -1;
+    run = 0;
+    job->skipped += blk;
+  }
+  if (run > 0)
+    return write_all(job, buf + len - run, run, off + len - run);
+  return 0;
+}
+
+/*
+ * Map a window of each file at a time. The input window is marked
+ * sequential so the kernel reads ahead aggressively and drops pages
+ * behind us. The output has already been extended to full size, so
+ * its pages can be written through the mapping. With -S, blocks of
+ * zeroes are never touched, so the output's pages there stay holes.
+ */
+int copy_mmap (copyjob *job)
+{
+  long pagesz = sysconf(_SC_PAGESIZE);
+  off_t base, off;
+  size_t len, skip, blk;
+  char *src, *dst;
+
+  while (job->pos < job->end) {
+    /*
+     * Mappings must start on a page boundary
+     */
+    base = job->pos & ~((off_t) pagesz - 1);
+    skip = job->pos - base;
+    len = job->window;
+    if (base + len > job->end)
+      len = job->end - base;
+
+    src = mmap(NULL, len, PROT_READ, MAP_SHARED, job->fdin, base);
+    if (src == MAP_FAILED)
+      return -1;
+    dst = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, job->fdout, base);
+    if (dst == MAP_FAILED) {
+      munmap(src, len);
+      return -1;
+    }
+    madvise(src, len, MADV_SEQUENTIAL);
+    job->syscalls += 3;
+
+    if (!job->sparse) {
+      memcpy(dst + skip, src + skip, len - skip);
+    } else {
+      for (off = job->pos; off < base + len; off += blk) {
+        blk = zero_block(off, base + len);
+        if (is_zero(src + (off - base), blk))
+          job->skipped += blk;
+        else
+          memcpy(dst + (off - base), src + (off - base), blk);
+      }
+    }
+    sum_data(job, src + skip, len - skip, job->pos);
+
+    munmap(src, len);
+    munmap(dst, len);
+    job->syscalls += 2;
+    job->pos = base + len;
+  }
+  return 0;
+}
+
+/*
+ * Read and write through a buffer, coping with short reads and writes
+ */
+int copy_rw (copyjob *job)
+{
+  char *buf;
+  size_t want;
+  ssize_t got;
+
+  buf = malloc(job->bufsz);
+  if (buf == NULL)
+    return -1;
+
+  while (job->pos < job->end) {
+    want = job->bufsz;
+    if (job->pos + want > job->end)
+      want = job->end - job->pos;
+
+    got = pread(job->fdin, buf, want, job->pos);
+    job->syscalls++;
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0) {
+      /*
+       * The input shrank while we copied it
+       */
+      if (got == 0)
+        errno = EIO;
+      free(buf);
+      return -1;
+    }
+
+    if (write_data(job, buf, got, job->pos) < 0) {
+      free(buf);
+      return -1;
+    }
+    sum_data(job, buf, got, job->pos);
+    job->pos += got;
+  }
+
+  free(buf);
+  return 0;
+}
+
+/*
+ * The kernel copies the data without showing it to us, so cfr and
+ * sendfile cannot checksum it
+ */
+int copy_cfr (copyjob *job)
+{
+  loff_t in, out;
+  size_t want;
+  ssize_t got;
+
+  if (job->checksum) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+
+  while (job->pos < job->end) {
+    want = job->end - job->pos;
+    if (want > KERNEL_CHUNK)
+      want = KERNEL_CHUNK;
+
+    in = out = job->pos;
+    got = copy_file_range(job->fdin, &in, job->fdout, &out, want, 0);
+    job->syscalls++;
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0) {
+      if (got == 0)
+        errno = EIO;
+      return -1;
+    }
+    job->pos += got;
+  }
+  return 0;
+}
+
+/*
+ * sendfile() writes at the output's file offset rather than taking
+ * one, so the offset is set first
+ */
+int copy_sendfile (copyjob *job)
+{
+  off_t in;
+  size_t want;
+  ssize_t got;
+
+  if (job->checksum) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+
+  if (lseek(job->fdout, job->pos, SEEK_SET) < 0)
+    return -1;
+  job->syscalls++;
+
+  while (job->pos < job->end) {
+    want = job->end - job->pos;
+    if (want > KERNEL_CHUNK)
+      want = KERNEL_CHUNK;
+
+    in = job->pos;
+    got = sendfile(job->fdout, job->fdin, &in, want);
+    job->syscalls++;
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0) {
+      if (got == 0)
+        errno = EIO;
+      return -1;
+    }
+    job->pos += got;
+  }
+  return 0;
+}
+
+/*
+ * io_uring, driven with the raw system calls so no library is needed.
+ * depth slots each own one buffer and cycle through reading a chunk
+ * and writing it back out, so up to depth requests are in flight at
+ * once. The buffers are registered with the kernel when allowed, which
+ * saves it mapping them on every request.
+ */
+typedef struct uring {
+  int                  fd;
+  unsigned            *sq_tail;
+  unsigned            *sq_mask;
+  unsigned            *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned            *cq_head;
+  unsigned            *cq_tail;
+  unsigned            *cq_mask;
+  struct io_uring_cqe *cqes;
+  void                *sq_ring;
+  void                *cq_ring;
+  size_t               sq_len;
+  size_t               cq_len;
+  size_t               sqes_len;
+  unsigned             pending;   /* Queued but not yet submitted */
+} uring;
+
+typedef struct slot {
+  off_t  off;       /* Where this slot's chunk starts */
+  size_t len;
+  size_t done;      /* How far into the chunk the current request is */
+  size_t stop;      /* and where in the chunk it ends */
+  int    writing;
+  int    busy;
+} slot;
+
+void uring_free (uring *r)
+{
+  if (r->sqes && r->sqes != MAP_FAILED)
+    munmap(r->sqes, r->sqes_len);
+  if (r->cq_ring && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring)
+    munmap(r->cq_ring, r->cq_len);
+  if (r->sq_ring && r->sq_ring != MAP_FAILED)
+    munmap(r->sq_ring, r->sq_len);
+  if (r->fd >= 0)
+    close(r->fd);
+}
+
+/*
+ * Returns -1 with errno ENOSYS when io_uring is not available, either
+ * because the kernel lacks it or because it has been turned off
+ */
+int uring_init (uring *r, unsigned entries)
+{
+  struct io_uring_params p;
+
+  memset(r, 0, sizeof(uring));
+  memset(&p, 0, sizeof(p));
+
+  r->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (r->fd < 0) {
+    if (errno == EPERM || errno == EACCES)
+      errno = ENOSYS;
+    return -1;
+  }
+
+  r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (r->cq_len > r->sq_len)
+      r->sq_len = r->cq_len;
+    r->cq_len = r->sq_len;
+  }
+
+  r->sq_ring = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  if (r->sq_ring == MAP_FAILED)
+    goto fail;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    r->cq_ring = r->sq_ring;
+  else
+    r->cq_ring = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+  if (r->cq_ring == MAP_FAILED)
+    goto fail;
+
+  r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED)
+    goto fail;
+
+  r->sq_tail = (unsigned *) ((char *) r->sq_ring + p.sq_off.tail);
+  r->sq_mask = (unsigned *) ((char *) r->sq_ring + p.sq_off.ring_mask);
+  r->sq_array = (unsigned *) ((char *) r->sq_ring + p.sq_off.array);
+  r->cq_head = (unsigned *) ((char *) r->cq_ring + p.cq_off.head);
+  r->cq_tail = (unsigned *) ((char *) r->cq_ring + p.cq_off.tail);
+  r->cq_mask = (unsigned *) ((char *) r->cq_ring + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *) ((char *) r->cq_ring + p.cq_off.cqes);
+  return 0;
+
+fail:
+  uring_free(r);
+  return -1;
+}
+
+/*
+ * Point slot s at the next part of its chunk to write, from s->stop
+ * on. That is the whole chunk, or with -S the next run of blocks that
+ * are not all zeroes, the way write_data() splits a buffer. Returns 0
+ * once nothing is left to write.
+ */
+int next_run (copyjob *job, slot *s, const char *buf)
+{
+  size_t at, blk;
+
+  if (!job->sparse) {
+    if (s->stop > 0)
+      return 0;
+    s->done = 0;
+    s->stop = s->len;
+    return 1;
+  }
+
+  for (at = s->stop; at < s->len; at += blk) {
+    blk = zero_block(s->off + at, s->off + s->len);
+    if (!is_zero(buf + at, blk))
+      break;
+    job->skipped += blk;
+  }
+  if (at == s->len)
+    return 0;
+
+  s->done = at;
+  for (; at < s->len; at += blk) {
+    blk = zero_block(s->off + at, s->off + s->len);
+    if (is_zero(buf + at, blk))
+      break;
+  }
+  s->stop = at;
+  return 1;
+}
+
+/*
+ * Queue a read or write of the rest of slot i's current request. At most one
+ * request per slot is ever queued, so the ring cannot fill up.
+ */
+void uring_queue (uring *r, slot *s, int i, char *buf, int fixed, int fd)
+{
+  struct io_uring_sqe *sqe;
+  unsigned tail, idx;
+
+  tail = *r->sq_tail;
+  idx = tail & *r->sq_mask;
+  sqe = &r->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+
+  if (s->writing)
+    sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  else
+    sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long) (buf + s->done);
+  sqe->len = s->stop - s->done;
+  sqe->off = s->off + s->done;
+  sqe->buf_index = i;
+  sqe->user_data = i;
+
+  r->sq_array[idx] = idx;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  r->pending++;
+}
+
+int copy_uring (copyjob *job)
+{
+  uring r;
+  slot *slots;
+  struct iovec *iov;
+  struct io_uring_cqe *cqe;
+  unsigned head, tail;
+  char *bufs;
+  off_t next = job->pos, start = job->pos, skipped = job->skipped;
+  off_t failed = job->end;
+  uint32_t crc = job->crc;
+  int depth = job->depth, fixed, inflight = 0, i, ret, res, err = 0;
+
+  if (uring_init(&r, depth) < 0)
+    return -1;
+
+  bufs = aligned_alloc(sysconf(_SC_PAGESIZE),
+                       (depth * job->bufsz + sysconf(_SC_PAGESIZE) - 1) &
+                       ~((size_t) sysconf(_SC_PAGESIZE) - 1));
+  slots = calloc(depth, sizeof(slot));
+  iov = calloc(depth, sizeof(struct iovec));
+  if (bufs == NULL || slots == NULL || iov == NULL) {
+    err = ENOMEM;
+    goto out;
+  }
+
+  /*
+   * Registering pins the buffers, which RLIMIT_MEMLOCK may not allow.
+   * Plain reads and writes work without it, just a little slower.
+   */
+  for (i = 0; i < depth; i++) {
+    iov[i].iov_base = bufs + i * job->bufsz;
+    iov[i].iov_len = job->bufsz;
+  }
+  fixed = syscall(__NR_io_uring_register, r.fd, IORING_REGISTER_BUFFERS,
+                  iov, depth) == 0;
+  job->syscalls += 2;
+
+  /*
+   * After a failure nothing new is queued, but the loop carries on
+   * until every request in flight has completed. Closing the ring does
+   * not wait for them, and they would otherwise read into freed buffers
+   * or write over what a fallback method copies next.
+   */
+  while ((err == 0 && next < job->end) || inflight > 0) {
+    /*
+     * Start reads on every idle slot
+     */
+    for (i = 0; i < depth && err == 0 && next < job->end; i++) {
+      if (slots[i].busy)
+        continue;
+      slots[i].busy = 1;
+      slots[i].writing = 0;
+      slots[i].off = next;
+      slots[i].done = 0;
+      slots[i].len = job->bufsz;
+      if (next + slots[i].len > job->end)
+        slots[i].len = job->end - next;
+      slots[i].stop = slots[i].len;
+      next += slots[i].len;
+      uring_queue(&r, &slots[i], i, iov[i].iov_base, fixed, job->fdin);
+      inflight++;
+    }
+
+    ret = syscall(__NR_io_uring_enter, r.fd, r.pending, 1,
+                  IORING_ENTER_GETEVENTS, NULL, 0);
+    job->syscalls++;
+    if (ret < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+        continue;
+      /*
+       * The ring itself is unusable, so what is in flight can never be
+       * reaped. The buffers are leaked below rather than freed under
+       * the kernel.
+       */
+      if (err == 0)
+        err = errno;
+      break;
+    }
+    r.pending -= ret;
+
+    head = *r.cq_head;
+    tail = __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      cqe = &r.cqes[head & *r.cq_mask];
+      i = cqe->user_data;
+      res = cqe->res;
+
+      if (err == 0 && (res == -EINTR || res == -EAGAIN)) {
+        uring_queue(&r, &slots[i], i, iov[i].iov_base, fixed,
+                    slots[i].writing ? job->fdout : job->fdin);
+        continue;
+      }
+      /*
+       * A read of 0 means the input shrank while we copied it
+       */
+      if (err == 0 && res <= 0)
+        err = res < 0 ? -res : EIO;
+
+      if (err != 0) {
+        /*
+         * Draining: retire the slot, noting where the earliest chunk
+         * that did not make it all the way to the output starts. A
+         * chunk with zeroes after its last write counts as unfinished,
+         * which only means a fallback copies it again.
+         */
+        if (res <= 0 || !slots[i].writing ||
+            slots[i].done + res < slots[i].len)
+          if (slots[i].off < failed)
+            failed = slots[i].off;
+        slots[i].busy = 0;
+        inflight--;
+        continue;
+      }
+
+      slots[i].done += res;
+      if (slots[i].done < slots[i].stop) {
+        uring_queue(&r, &slots[i], i, iov[i].iov_base, fixed,
+                    slots[i].writing ? job->fdout : job->fdin);
+        continue;
+      }
+      if (!slots[i].writing) {
+        sum_data(job, iov[i].iov_base, slots[i].len, slots[i].off);
+        slots[i].writing = 1;
+        slots[i].stop = 0;
+      }
+      /*
+       * Write the chunk's next run, if it has one. With -S one write
+       * goes out per run of data, and its zero blocks stay holes.
+       */
+      if (next_run(job, &slots[i], iov[i].iov_base)) {
+        uring_queue(&r, &slots[i], i, iov[i].iov_base, fixed, job->fdout);
+      } else {
+        slots[i].busy = 0;
+        inflight--;
+      }
+    }
+    __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  /*
+   * Completions arrive out of order, so on failure only the part
+   * before the earliest unfinished chunk is known to be copied. With
+   * -k, chunks after that one may already be in the checksum, so the
+   * whole call is undone rather than have them summed twice.
+   */
+  if (err != 0 && inflight > 0 && unsupported(err))
+    err = EIO;      /* Nothing may fall back while requests are live */
+  if (err == 0) {
+    job->pos = job->end;
+  } else if (job->checksum) {
+    job->pos = start;
+    job->crc = crc;
+    job->skipped = skipped;
+  } else {
+    job->pos = next < failed ? next : failed;
+    for (i = 0; i < depth; i++)
+      if (slots[i].busy && slots[i].off < job->pos)
+        job->pos = slots[i].off;
+  }
+
+out:
+  uring_free(&r);
+  free(iov);
+  free(slots);
+  if (inflight == 0)
+    free(bufs);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+method methods[] = {
+  { "mmap",     copy_mmap },
+  { "rw",       copy_rw },
+  { "cfr",      copy_cfr },
+  { "sendfile", copy_sendfile },
+  { "uring",    copy_uring },
+};
+
+#define NUM_METHODS (sizeof(methods) / sizeof(methods[0]))
+
+method *find_method (const char *name)
+{
+  int i;
+
+  for (i = 0; i < NUM_METHODS; i++)
+    if (strcmp(methods[i].name, name) == 0)
+      return &methods[i];
+  return NULL;
+}
+
+/*
+ * What auto tries, in order, for a file of the given size. Each
+ * method is only used if the ones before it are not supported for
+ * these files; copy_file_range() and sendfile() both fail across some
+ * file system combinations, read/write always works.
+ */
+int auto_methods (off_t size, method **order)
+{
+  int n = 0;
+
+  if (size >= SMALL_FILE) {
+    order[n++] = find_method("cfr");
+    order[n++] = find_method("sendfile");
+  }
+  order[n++] = find_method("rw");
+  return n;
+}
+
+double now (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Parse a size with an optional k, m or g suffix
+ */
+size_t parse_size (const char *s)
+{
+  char *end;
+  size_t n;
+
+  n = strtoull(s, &end, 10);
+  switch (*end) {
+  case 'k': case 'K': n <<= 10; break;
+  case 'm': case 'M': n <<= 20; break;
+  case 'g': case 'G': n <<= 30; break;
+  }
+  return n;
+}
+
+/*
+ * Write the input's pages back if they are dirty and drop them from
+ * the page cache, so the next copy has to read it from the device
+ */
+void drop_cache (int fd)
+{
+  int err;
+
+  fdatasync(fd);
+  err = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  if (err != 0) {
+    errno = err;
+    err_sys("posix_fadvise");
+  }
+}
+
+/*
+ * Give the output its full size up front. fallocate() reserves the
+ * blocks as well, so the copy never stops to allocate them and the
+ * file is laid out in one piece. File systems without it just get
+ * the size, and so does a sparse copy, which wants the output to start
+ * out as one big hole.
+ */
+void preallocate (int fd, off_t size, int sparse)
+{
+  if (ftruncate(fd, 0) < 0)
+    err_sys("can't truncate the output file");
+  if (size == 0)
+    return;
+  if (!sparse && fallocate(fd, 0, 0, size) == 0)
+    return;
+  if (!sparse && !unsupported(errno))
+    err_sys("can't preallocate the output file");
+  if (ftruncate(fd, size) < 0)
+    err_sys("can't size the output file");
+}
+
+/*
+ * Copy job's range with the given methods, falling back from one to
+ * the next when a method is unsupported. Returns 0, or -1 with errno
+ * set. *used is the last method tried.
+ */
+int copy_methods (copyjob *job, method **order, int n, const char **used)
+{
+  int i;
+
+  for (i = 0; i < n && job->pos < job->end; i++) {
+    *used = order[i]->name;
+    if (order[i]->copy(job) == 0)
+      return 0;
+    if (!unsupported(errno))
+      return -1;
+  }
+  return job->pos < job->end ? -1 : 0;
+}
+
+/*
+ * Copy job's range, with -S one data extent at a time. Holes in the
+ * input are already holes in the freshly sized output, so they are
+ * skipped over. File systems that cannot report holes fail SEEK_DATA
+ * with EINVAL, and then the whole range is treated as data.
+ */
+int copy_range (copyjob *job, method **order, int n, const char **used)
+{
+  off_t end = job->end, data, hole;
+  int ret;
+
+  if (!job->sparse)
+    return copy_methods(job, order, n, used);
+
+  while (job->pos < end) {
+    data = lseek(job->fdin, job->pos, SEEK_DATA);
+    job->syscalls++;
+    if (data < 0 && errno == EINVAL) {
+      data = job->pos;
+      hole = end;
+    } else if (data < 0 && errno == ENXIO) {
+      /*
+       * Nothing but hole from here to the end of the file
+       */
+      data = end;
+    } else if (data < 0) {
+      return -1;
+    } else {
+      hole = data < end ? lseek(job->fdin, data, SEEK_HOLE) : end;
+      job->syscalls++;
+      if (hole < 0 || hole > end)
+        hole = end;
+    }
+
+    if (data >= end) {
+      job->skipped += end - job->pos;
+      job->pos = end;
+      break;
+    }
+
+    job->skipped += data - job->pos;
+    job->pos = data;
+    job->end = hole;
+    ret = copy_methods(job, order, n, used);
+    job->end = end;
+    if (ret < 0)
+      return -1;
+  }
+  return 0;
+}
+
+/*
+ * One thread's share of a parallel copy
+ */
+typedef struct worker {
+  pthread_t   thread;
+  copyjob     job;
+  method    **order;
+  int         n;
+  runopts    *ro;
+  const char *used;
+  int         err;
+} worker;
+
+/*
+ * Each thread opens the files itself. sendfile() writes at the file
+ * offset, which threads sharing one descriptor would fight over.
+ */
+void *copy_worker (void *arg)
+{
+  worker *w = arg;
+
+  w->job.fdin = open(w->ro->from, O_RDONLY);
+  w->job.fdout = open(w->ro->to, O_RDWR);
+  if (w->job.fdin < 0 || w->job.fdout < 0)
+    w->err = errno;
+  else if (copy_range(&w->job, w->order, w->n, &w->used) < 0)
+    w->err = errno;
+
+  if (w->job.fdin >= 0)
+    close(w->job.fdin);
+  if (w->job.fdout >= 0)
+    close(w->job.fdout);
+  return NULL;
+}
+
+/*
+ * CRC32C of what the file holds now, read back from the device. Holes
+ * are skipped since they read as zeroes.
+ */
+uint32_t checksum_file (int fd, off_t size)
+{
+  char *buf;
+  off_t pos = 0, data, hole;
+  uint32_t raw = 0;
+  ssize_t got;
+
+  drop_cache(fd);
+  buf = malloc(DEFAULT_WINDOW);
+  if (buf == NULL)
+    err_sys("malloc");
+
+  while (pos < size) {
+    data = lseek(fd, pos, SEEK_DATA);
+    if (data < 0 && errno == ENXIO)
+      break;
+    hole = data < 0 ? size : lseek(fd, data, SEEK_HOLE);
+    if (data < 0)
+      data = pos;
+    if (hole < 0 || hole > size)
+      hole = size;
+
+    for (pos = data; pos < hole; pos += got) {
+      got = pread(fd, buf, hole - pos < DEFAULT_WINDOW ? hole - pos :
+                  DEFAULT_WINDOW, pos);
+      if (got < 0 && errno == EINTR) {
+        got = 0;
+        continue;
+      }
+      if (got <= 0)
+        err_sys("can't read back the output file");
+      raw ^= crc_shift(crc_update(0, buf, got), size - (pos + got));
+    }
+  }
+
+  free(buf);
+  return crc_final(raw, size);
+}
+
+/*
+ * Copy the whole input with the given methods and print the
+ * throughput. With more than one thread the file is cut into equal
+ * shares, rounded to SPLIT_ALIGN so mmap windows stay page aligned,
+ * and each thread copies one share. A file too small to give every
+ * thread a share uses fewer threads.
+ */
+void run (int fdin, int fdout, off_t size, method **order, int n,
+          copyjob *opts, runopts *ro, const char *label)
+{
+  worker *w;
+  double start, elapsed;
+  const char *used = "none";
+  off_t share, skipped = 0;
+  uint32_t crc = 0, check;
+  long syscalls = 0;
+  int i, nw, err = 0;
+
+  share = (size + ro->threads - 1) / ro->threads;
+  share = (share + SPLIT_ALIGN - 1) & ~((off_t) SPLIT_ALIGN - 1);
+  nw = size > 0 ? (size + share - 1) / share : 1;
+
+  w = calloc(nw, sizeof(worker));
+  if (w == NULL)
+    err_sys("calloc");
+  for (i = 0; i < nw; i++) {
+    w[i].job = *opts;
+    w[i].job.size = size;
+    w[i].job.pos = i * share;
+    w[i].job.end = w[i].job.pos + share < size ? w[i].job.pos + share : size;
+    w[i].order = order;
+    w[i].n = n;
+    w[i].ro = ro;
+    w[i].used = "none";
+  }
+
+  preallocate(fdout, size, opts->sparse);
+  if (ro->cold)
+    drop_cache(fdin);
+
+  start = now();
+  if (nw == 1) {
+    w[0].job.fdin = fdin;
+    w[0].job.fdout = fdout;
+    if (copy_range(&w[0].job, order, n, &w[0].used) < 0)
+      w[0].err = errno;
+  } else {
+    for (i = 0; i < nw; i++)
+      if ((errno = pthread_create(&w[i].thread, NULL, copy_worker, &w[i])) != 0)
+        err_sys("pthread_create");
+    for (i = 0; i < nw; i++)
+      pthread_join(w[i].thread, NULL);
+  }
+  if (ro->sync) {
+    fsync(fdout);
+    syscalls++;
+  }
+  elapsed = now() - start;
+
+  used = w[0].used;
+  for (i = 0; i < nw; i++) {
+    syscalls += w[i].job.syscalls;
+    skipped += w[i].job.skipped;
+    crc ^= w[i].job.crc;
+    if (strcmp(used, "none") == 0)
+      used = w[i].used;
+    if (w[i].err != 0 && err == 0) {
+      err = w[i].err;
+      used = w[i].used;
+    }
+  }
+  free(w);
+
+  if (err != 0 && !unsupported(err)) {
+    errno = err;
+    err_sys(used);
+  }
+  crc = crc_final(crc, size);
+
+  if (ro->csv) {
+    if (err != 0)
+      printf("%s,%zu,%zu,%d,%d,%s,%lld,,,,,\n", label, opts->bufsz,
+             opts->window, opts->depth, nw, ro->cold ? "cold" : "warm",
+             (long long) size);
+    else
+      printf("%s,%zu,%zu,%d,%d,%s,%lld,%.6f,%.1f,%ld,%lld,", used,
+             opts->bufsz, opts->window, opts->depth, nw,
+             ro->cold ? "cold" : "warm", (long long) size, elapsed,
+             elapsed > 0 ? size / elapsed / 1e6 : 0.0, syscalls,
+             (long long) skipped);
+    if (opts->checksum)
+      printf("%08x", crc);
+    printf("\n");
+  } else if (err != 0) {
+    printf("%-8s %-8s not supported for these files: %s\n", label, used,
+           strerror(err));
+  } else {
+    printf("%-8s %-8s %12lld bytes %9.3f s %10.1f MB/s %10ld syscalls"
+           " %3d threads\n", label, used, (long long) size, elapsed,
+           elapsed > 0 ? size / elapsed / 1e6 : 0.0, syscalls, nw);
+    if (opts->sparse)
+      printf("%-8s %-8s %12lld bytes left as holes\n", "", "",
+             (long long) skipped);
+    if (opts->checksum)
+      printf("%-8s %-8s crc32c %08x\n", "", "", crc);
+  }
+
+  /*
+   * A copy that failed has nothing to check
+   */
+  if (ro->verify && err == 0) {
+    check = checksum_file(fdout, size);
+    if (check != crc) {
+      printf("%s: %s has crc32c %08x, expected %08x\n", label, ro->to,
+             check, crc);
+      exit(1);
+    }
+  }
+}
+
+int main (int argc, char *argv[])
+{
+  int fdin, fdout, opt, bufset = 0, i, n;
+  const char *name = "auto";
+  char buf[256];
+  struct stat statbuf;
+  copyjob opts;
+  runopts ro;
+  method *order[NUM_METHODS];
+
+  memset(&opts, 0, sizeof(opts));
+  memset(&ro, 0, sizeof(ro));
+  opts.bufsz = DEFAULT_BUF;
+  opts.window = DEFAULT_WINDOW;
+  opts.depth = DEFAULT_DEPTH;
+  ro.threads = 1;
+
+  while ((opt = getopt(argc, argv, "m:b:w:d:t:SkVscC")) != -1) {
+    switch (opt) {
+    case 'm':
+      name = optarg;
+      break;
+    case 'b':
+      opts.bufsz = parse_size(optarg);
+      bufset = 1;
+      break;
+    case 'w':
+      opts.window = parse_size(optarg);
+      break;
+    case 'd':
+      opts.depth = atoi(optarg);
+      break;
+    case 't':
+      ro.threads = atoi(optarg);
+      break;
+    case 'S':
+      opts.sparse = 1;
+      break;
+    case 'V':
+      ro.verify = 1;
+      /* fall through, checking needs the checksum */
+    case 'k':
+      opts.checksum = 1;
+      break;
+    case 's':
+      ro.sync = 1;
+      break;
+    case 'c':
+      ro.cold = 1;
+      break;
+    case 'C':
+      ro.csv = 1;
+      break;
+    default:
+      err_quit("usage: mcopy [-m auto|all|mmap|rw|cfr|sendfile|uring] "
+               "[-b buf_size] [-w window] [-d depth] [-t threads] [-S] [-k] "
+               "[-V] [-s] [-c] [-C] <fromfile> <tofile>");
+    }
+  }
+
+  if (argc - optind != 2)
+    err_quit("usage: mcopy [-m auto|all|mmap|rw|cfr|sendfile|uring] "
+             "[-b buf_size] [-w window] [-d depth] [-t threads] [-S] [-k] "
+             "[-V] [-s] [-c] [-C] <fromfile> <tofile>");
+
+  if (opts.bufsz == 0)
+    err_quit("buffer size must be positive");
+  if (opts.depth < 1 || opts.depth > 4096)
+    err_quit("depth must be from 1 to 4096");
+  if (ro.threads < 1 || ro.threads > 1024)
+    err_quit("threads must be from 1 to 1024");
+  ro.from = argv[optind];
+  ro.to = argv[optind + 1];
+
+  /*
+   * The window has to be a whole number of pages
+   */
+  opts.window &= ~((size_t) sysconf(_SC_PAGESIZE) - 1);
+  if (opts.window == 0)
+    err_quit("window must be at least a page");
+
+  if ((fdin = open (argv[optind], O_RDONLY)) < 0) {
+    sprintf(buf, "can't open %s for reading", argv[optind]);
+    perror(buf);
+    exit(errno);
+  }
+
+  if ((fdout = open (argv[optind + 1], O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+    sprintf(buf, "can't create %s for writing", argv[optind + 1]);
+    perror(buf);
+    exit(errno);
+  }
+
+  if (fstat(fdin, &statbuf) < 0)
+    err_sys("input file size check failed");
+
+  if (opts.checksum)
+    crc_init();
+
+  if (strcmp(name, "all") == 0) {
+    for (i = 0; i < NUM_METHODS; i++) {
+      order[0] = &methods[i];
+      order[1] = find_method("rw");
+      run(fdin, fdout, statbuf.st_size, order, 2, &opts, &ro, methods[i].name);
+    }
+  } else if (strcmp(name, "auto") == 0) {
+    n = auto_methods(statbuf.st_size, order);
+    if (!bufset && statbuf.st_size > 0 && statbuf.st_size < SMALL_FILE)
+      opts.bufsz = statbuf.st_size;
+    run(fdin, fdout, statbuf.st_size, order, n, &opts, &ro, "auto");
+  } else if ((order[0] = find_method(name)) != NULL) {
+    order[1] = find_method("rw");
+    run(fdin, fdout, statbuf.st_size, order, 2, &opts, &ro, name);
+  } else {
+    sprintf(buf, "unknown method %s", name);
+    err_quit(buf);
+  }
+
+  close(fdin);
+  close(fdout);
+  return 0;
+}
@@ -21,6 +21,7 @@ void err_sys (const char * mesg)
 int main (int argc, char *argv[])
 {
   int fdin, fdout, bufsz;
+  ssize_t n;
   char *src;
   struct stat statbuf;
 
@@ -47,9 +48,10 @@ int main (int argc, char *argv[])
   bufsz = atoi(argv[3]);
   src = malloc(bufsz);
   
-  /* And use it to copy the file */
-  while ((read (fdin, src, bufsz)) > 0) {
-    write (fdout, src, bufsz);
+  /* And use it to copy the file, writing only as much as was read */
+  while ((n = read (fdin, src, bufsz)) > 0) {
+    if (write (fdout, src, n) != n)
+      err_sys ("write error");
   }
 } /* main */
 
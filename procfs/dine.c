@@ -4,17 +4,30 @@
 #include <math.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
 #include <sys/types.h>
 #include <linux/unistd.h>
 
+#include "watchdog.h"
+
 #define gettid() syscall(__NR_gettid)
 
 #define NUM_PHILS 5
 #define MAX_BUF 256
 #define NUM_CHOPS NUM_PHILS
-#define FIELDS_TO_IGNORE 13
+
+/*
+ * The watchdog samples the philosophers every WATCHDOG_INTERVAL_MS and
+ * calls it a deadlock once none of them has made progress for
+ * STALL_MS. Progress is printed every ACCOUNTING_PERIOD seconds.
+ */
+#define WATCHDOG_INTERVAL_MS 100
+#define STALL_MS 1000
+#define ACCOUNTING_PERIOD 5
 
 #define DEADLOCK 1
 #define ACTIVE_DURATION 200
@@ -29,11 +42,14 @@ typedef struct {
 /* GLOBALS */
 static philosopher diners[NUM_PHILS];
 static int stop=0;
+static uint64_t seed;
 static pthread_mutex_t chopstick[NUM_CHOPS];
 static unsigned long user_progress[NUM_PHILS];
 static unsigned long user_time[NUM_PHILS];
 static unsigned long sys_progress[NUM_PHILS];
 static unsigned long sys_time[NUM_PHILS];
+static watchdog *wd;
+static sem_t deadlocked;
 
 
 /*
@@ -87,6 +103,46 @@ void eat_one_mouthful()
   }
 }
 
+/*
+ * Per-philosopher PCG32 random number generator. rand() shares one
+ * locked state between all threads, which would have the philosophers
+ * contending on the RNG as well as on the chopsticks.
+ */
+typedef struct {
+  uint64_t state;
+  uint64_t inc;
+} rng_t;
+
+static uint32_t rng_next(rng_t *r)
+{
+  uint64_t old = r->state;
+  uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+  uint32_t rot = old >> 59;
+
+  r->state = old * 6364136223846793005ULL + r->inc;
+  return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+/*
+ * Every philosopher gets its own stream, picked by its id
+ */
+static void rng_seed(rng_t *r, uint64_t s, int id)
+{
+  r->state = 0;
+  r->inc = ((uint64_t) id << 1) | 1;
+  rng_next(r);
+  r->state += s;
+  rng_next(r);
+}
+
+/*
+ * A number from 0 to bound - 1
+ */
+static int rng_below(rng_t *r, int bound)
+{
+  return (int) (((uint64_t) rng_next(r) * (uint32_t) bound) >> 32);
+}
+
 /*
  * Philosopher code
  */
@@ -96,14 +152,16 @@ static void *dp_thread(void *arg)
   int eat_rnd;
   int i;
   philosopher *me;
+  rng_t rng;
 
   me = (philosopher *) arg;
+  rng_seed(&rng, seed, me->id);
 
   me->tid = gettid();
 
   while (!stop) {
-    think_rnd = (rand() % 10000);
-    eat_rnd = (rand() % 10000);
+    think_rnd = rng_below(&rng, 10000);
+    eat_rnd = rng_below(&rng, 10000);
 
     /*
      * Think a random number of thoughts before getting hungry
@@ -209,91 +267,72 @@ void print_progress()
   printf("\n");
 }
 
-int check_for_deadlock()
+/*
+ * Called by the watchdog once every philosopher has stalled
+ */
+void on_stall(watchdog *w, int idx, void *arg)
 {
-  int   deadlock;
-  char  filename[MAX_BUF];
-  int   i;
-  int   j;
-  FILE *statf;
+  sem_post(&deadlocked);
+}
 
-  unsigned long new_sys_time;
-  unsigned long new_user_time;
+/*
+ * Work out how much time each philosopher spent since the last call
+ */
+void update_progress()
+{
+  watchdog_counts counts;
+  int i;
 
-  deadlock = 1;
   for (i = 0; i < NUM_PHILS; i++) {
+    watchdog_get(wd, i, &counts);
 
-    /*
-     * 1. Store the stat filename for this diner into a buffer. Use the sprintf
-     * library call.
-     */
-    sprintf(filename, "/proc/self/task/%d/stat", diners[i].tid);
-
-    /*
-     * 2. Use fopen to open the stat file as a file stream. Open it
-     * with read only permissions.
-     */
-    statf = fopen(filename, "r");
-
-    /*
-     * 3. Seek over uninteresting fields. Use fscanf to perform the seek.  You
-     * also need to determine how many fields to skip over - see proc(5)
-     * HINT: Use the the * qualifier to skip tokens without storing them.
-     */
-    for(j = 0; j < FIELDS_TO_IGNORE; j++) fscanf(statf, "%*s");
-
-    /*
-     * 4. Read the time values you want. Use fscanf again.
-     */
-    fscanf(statf, "%lu", &new_user_time);
-    fscanf(statf, "%lu", &new_sys_time);
-
-    user_progress[i] = new_user_time - user_time[i];
-    user_time[i] = new_user_time;
-
-    sys_progress[i] = new_sys_time - sys_time[i];
-    sys_time[i] = new_sys_time;
-
-    /*
-     * 5. Use time values to determine if deadlock has occurred.
-     */
-    if((user_progress[i] > 0) || (sys_progress[i] > 0))
-      deadlock = 0;
-
-    /*
-     * 6. Close the stat file stream
-     */
-    fclose(statf);
+    user_progress[i] = counts.utime - user_time[i];
+    user_time[i] = counts.utime;
 
+    sys_progress[i] = counts.stime - sys_time[i];
+    sys_time[i] = counts.stime;
   }
-
-  return deadlock;
 }
 
 
 int main(int argc, char **argv)
 {
+  struct timespec deadline;
   int i;
   int deadlock;
   deadlock = 0;
 
-  srand(time(NULL));
+  seed = time(NULL);
+
+  sem_init(&deadlocked, 0, 0);
+  wd = watchdog_create(WATCHDOG_INTERVAL_MS, STALL_MS, WATCHDOG_ALL,
+                       on_stall, NULL);
+  if (wd == NULL) {
+    fprintf(stderr, "watchdog_create failed\n");
+    return 1;
+  }
 
   set_table();
 
-  do {
-    /*
-     * Let the philosophers do some thinking and eating
-     */
-    sleep(5);
+  for (i = 0; i < NUM_PHILS; i++) {
+    if (watchdog_add(wd, diners[i].tid) != i) {
+      perror("watchdog_add");
+      return 1;
+    }
+  }
+  watchdog_start(wd);
 
+  do {
     /*
-     * Check for deadlock (i.e. none of the philosophers are
-     * making progress)
+     * Let the philosophers do some thinking and eating, unless the
+     * watchdog finds none of them making progress first
      */
-    deadlock = 0;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ACCOUNTING_PERIOD;
+    while ((i = sem_timedwait(&deadlocked, &deadline)) == -1 && errno == EINTR)
+      ;
 
-    if (check_for_deadlock()) {
+    if (i == 0) {
       deadlock = 1;
       break;
     }
@@ -301,9 +340,11 @@ int main(int argc, char **argv)
     /*
      * Print out the philosophers progress
      */
+    update_progress();
     print_progress();
   } while (!deadlock);
 
+  watchdog_destroy(wd);
   stop = 1;
   printf ("Reached deadlock\n");
 
@@ -4,6 +4,10 @@
  * Build: gcc -o procstat procstat.c
  * Usage: procstat pid
  *        cat /proc/pid/stat | procstat
+ *        procstat -s [-i msec] [-n samples] [-m name] [-q] [pid...]
+ *        procstat -s -t [-k column] [-l lines] [-i msec] [-n samples] [-m name] [pid...]
+ *        procstat -s -w file [-i msec] [-n samples] [-m name] [pid...]
+ *        procstat -r file [-q] [-t [-k column]] [-a] [-l lines] [-f first] [-n samples]
  *
  * Homepage: http://www.brokestream.com/procstat.html
  * Version : 2009-03-05
@@ -14,6 +18,13 @@
  *
  * 2009-03-05 tickspersec are taken from sysconf (Sabuj Pattanayek)
  *
+ * 2026-10-18 stat is read with one read() and split by hand instead of
+ *            fscanf, so process names with spaces or parentheses parse.
+ *            Added -s, which samples many processes periodically, and
+ *            -t, which shows per-interval rates like top, and -w,
+ *            which logs samples to a compact binary file that -r reads
+ *            back.
+ *
  */
 
 
@@ -39,71 +50,201 @@
 
 */
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include <linux/limits.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/times.h>
 
 
 typedef long long int num;
 
-num pid;
-char tcomm[PATH_MAX];
-char state;
-
-num ppid;
-num pgid;
-num sid;
-num tty_nr;
-num tty_pgrp;
-
-num flags;
-num min_flt;
-num cmin_flt;
-num maj_flt;
-num cmaj_flt;
-num utime;
-num stimev;
-
-num cutime;
-num cstime;
-num priority;
-num nicev;
-num num_threads;
-num it_real_value;
-
-unsigned long long start_time;
-
-num vsize;
-num rss;
-num rsslim;
-num start_code;
-num end_code;
-num start_stack;
-num esp;
-num eip;
-
-num pending;
-num blocked;
-num sigign;
-num sigcatch;
-num wchan;
-num zero1;
-num zero2;
-num exit_signal;
-num cpu;
-num rt_priority;
-num policy;
+/*
+ * The kernel caps comm at 16 bytes but kernel threads may show longer
+ * names, so leave room for those.
+ */
+#define COMM_MAX 64
+
+/*
+ * A stat line is a few hundred bytes, this leaves plenty of slack
+ */
+#define STAT_BUF 4096
+
+typedef struct {
+  num pid;
+  char tcomm[COMM_MAX];
+  char state;
+
+  num ppid;
+  num pgid;
+  num sid;
+  num tty_nr;
+  num tty_pgrp;
+
+  num flags;
+  num min_flt;
+  num cmin_flt;
+  num maj_flt;
+  num cmaj_flt;
+  num utime;
+  num stimev;
+
+  num cutime;
+  num cstime;
+  num priority;
+  num nicev;
+  num num_threads;
+  num it_real_value;
+
+  unsigned long long start_time;
+
+  num vsize;
+  num rss;
+  num rsslim;
+  num start_code;
+  num end_code;
+  num start_stack;
+  num esp;
+  num eip;
+
+  num pending;
+  num blocked;
+  num sigign;
+  num sigcatch;
+  num wchan;
+  num zero1;
+  num zero2;
+  num exit_signal;
+  num cpu;
+  num rt_priority;
+  num policy;
+} procstat;
 
 long tickspersec;
+long pagesize;
+
+/*
+ * Walks a stat line one field at a time. Fields missing from the end
+ * of the line (older kernels print fewer) read as zero.
+ */
+typedef struct {
+  const char *p;
+  const char *end;
+  int bad;        /* Snapshot reads ran off the end */
+} cursor;
 
-FILE *input;
+void skipspace(cursor *c) { while(c->p < c->end && *c->p == ' ') c->p++; }
 
-void readone(num *x) { fscanf(input, "%lld ", x); }
-void readunsigned(unsigned long long *x) { fscanf(input, "%llu ", x); }
-void readstr(char *x) {  fscanf(input, "%s ", x);}
-void readchar(char *x) {  fscanf(input, "%c ", x);}
+/*
+ * Values too big for a num, like an unlimited rsslim, saturate the way
+ * fscanf("%lld") does
+ */
+void readone(cursor *c, num *x) {
+  int neg = 0, d;
+  num v = 0;
+
+  skipspace(c);
+  if(c->p < c->end && *c->p == '-') { neg = 1; c->p++; }
+  while(c->p < c->end && *c->p >= '0' && *c->p <= '9') {
+    d = *c->p++ - '0';
+    v = v > (LLONG_MAX - d) / 10 ? LLONG_MAX : v * 10 + d;
+  }
+  *x = neg ? -v : v;
+}
+
+void readunsigned(cursor *c, unsigned long long *x) {
+  unsigned long long v = 0;
+
+  skipspace(c);
+  while(c->p < c->end && *c->p >= '0' && *c->p <= '9') v = v * 10 + (*c->p++ - '0');
+  *x = v;
+}
+
+void readchar(cursor *c, char *x) {
+  skipspace(c);
+  *x = c->p < c->end ? *c->p++ : '?';
+}
+
+/*
+ * comm is wrapped in parentheses but may itself hold spaces and
+ * parentheses, so it runs from the first '(' to the last ')' on the
+ * line. Returns 0 if the line is not shaped like a stat line.
+ */
+int readcomm(cursor *c, char *x) {
+  const char *open, *close;
+  size_t len;
+
+  open = memchr(c->p, '(', c->end - c->p);
+  for(close = c->end - 1; close > c->p && *close != ')'; close--);
+  if(!open || close <= open) return 0;
+
+  len = close - open - 1;
+  if(len >= COMM_MAX) len = COMM_MAX - 1;
+  memcpy(x, open + 1, len);
+  x[len] = '\0';
+  c->p = close + 1;
+  return 1;
+}
+
+/*
+ * Parse one /proc/pid/stat line of len bytes into s
+ */
+int parsestat(const char *buf, size_t len, procstat *s) {
+  cursor c = { buf, buf + len, 0 };
+
+  readone(&c, &s->pid);
+  if(!readcomm(&c, s->tcomm)) return 0;
+  readchar(&c, &s->state);
+  readone(&c, &s->ppid);
+  readone(&c, &s->pgid);
+  readone(&c, &s->sid);
+  readone(&c, &s->tty_nr);
+  readone(&c, &s->tty_pgrp);
+  readone(&c, &s->flags);
+  readone(&c, &s->min_flt);
+  readone(&c, &s->cmin_flt);
+  readone(&c, &s->maj_flt);
+  readone(&c, &s->cmaj_flt);
+  readone(&c, &s->utime);
+  readone(&c, &s->stimev);
+  readone(&c, &s->cutime);
+  readone(&c, &s->cstime);
+  readone(&c, &s->priority);
+  readone(&c, &s->nicev);
+  readone(&c, &s->num_threads);
+  readone(&c, &s->it_real_value);
+  readunsigned(&c, &s->start_time);
+  readone(&c, &s->vsize);
+  readone(&c, &s->rss);
+  readone(&c, &s->rsslim);
+  readone(&c, &s->start_code);
+  readone(&c, &s->end_code);
+  readone(&c, &s->start_stack);
+  readone(&c, &s->esp);
+  readone(&c, &s->eip);
+  readone(&c, &s->pending);
+  readone(&c, &s->blocked);
+  readone(&c, &s->sigign);
+  readone(&c, &s->sigcatch);
+  readone(&c, &s->wchan);
+  readone(&c, &s->zero1);
+  readone(&c, &s->zero2);
+  readone(&c, &s->exit_signal);
+  readone(&c, &s->cpu);
+  readone(&c, &s->rt_priority);
+  readone(&c, &s->policy);
+  return 1;
+}
 
 void printone(char *name, num x) {  printf("%20s: %lld\n", name, x);}
 void printonex(char *name, num x) {  printf("%20s: %016llx\n", name, x);}
@@ -132,109 +273,1233 @@ void printtimediff(char *name, num x) {
   printf("%20s: %s (%lu.%lus)\n", name, buf, running / tickspersec, running % tickspersec);
 }
 
+void printstat(procstat *s) {
+  char comm[COMM_MAX + 2];
+
+  snprintf(comm, sizeof(comm), "(%s)", s->tcomm);
+
+  printone("pid", s->pid);
+  printstr("tcomm", comm);
+  printchar("state", s->state);
+  printone("ppid", s->ppid);
+  printone("pgid", s->pgid);
+  printone("sid", s->sid);
+  printone("tty_nr", s->tty_nr);
+  printone("tty_pgrp", s->tty_pgrp);
+  printone("flags", s->flags);
+  printone("min_flt", s->min_flt);
+  printone("cmin_flt", s->cmin_flt);
+  printone("maj_flt", s->maj_flt);
+  printone("cmaj_flt", s->cmaj_flt);
+  printtime("utime", s->utime);
+  printtime("stime", s->stimev);
+  printtime("cutime", s->cutime);
+  printtime("cstime", s->cstime);
+  printone("priority", s->priority);
+  printone("nice", s->nicev);
+  printone("num_threads", s->num_threads);
+  printtime("it_real_value", s->it_real_value);
+  printtimediff("start_time", s->start_time);
+  printone("vsize", s->vsize);
+  printone("rss", s->rss);
+  printone("rsslim", s->rsslim);
+  printone("start_code", s->start_code);
+  printone("end_code", s->end_code);
+  printone("start_stack", s->start_stack);
+  printone("esp", s->esp);
+  printone("eip", s->eip);
+  printonex("pending", s->pending);
+  printonex("blocked", s->blocked);
+  printonex("sigign", s->sigign);
+  printonex("sigcatch", s->sigcatch);
+  printone("wchan", s->wchan);
+  printone("zero1", s->zero1);
+  printone("zero2", s->zero2);
+  printonex("exit_signal", s->exit_signal);
+  printone("cpu", s->cpu);
+  printone("rt_priority", s->rt_priority);
+  printone("policy", s->policy);
+}
+
+/*
+ * Sampling mode.
+ *
+ * Every process being watched has an entry in a table sorted by pid,
+ * which keeps its stat file open between samples: a pread() at offset
+ * 0 of an open /proc file regenerates it, which is much cheaper than
+ * opening it again by path. Each sample lists /proc, merges the pids
+ * found into the table, then reads every entry into one shared buffer.
+ */
+/*
+ * The few counters of the previous sample that rates are worked out
+ * from. start_time tells a reused pid from the process it replaced.
+ */
+typedef struct {
+  unsigned long long start_time;
+  num utime;
+  num stimev;
+  num min_flt;
+  num maj_flt;
+  num rss;
+} procprev;
+
+typedef struct {
+  int pid;
+  int fd;         /* Open stat file, or -1 to open it on each read */
+  int ignored;    /* Does not match -m, never read again */
+  int haveprev;   /* prev holds the sample before this one */
+  procprev prev;
+  procstat stat;  /* Latest sample */
+} procentry;
+
+typedef struct {
+  procentry *procs;
+  int nprocs;
+  int cap;
+  int *pids;      /* Pids found by the latest /proc scan */
+  int npids;
+  int pidcap;
+  DIR *dir;
+  int nofiles;    /* Out of fds, stop keeping new files open */
+  char buf[STAT_BUF];
+} sampler;
+
+/*
+ * Options for sampling mode
+ */
+const char *match;  /* -m: only processes whose name contains this */
+int *only;          /* Pids given on the command line, if any */
+int nonly;
+
+int cmpint(const void *a, const void *b) {
+  int x = *(const int *) a, y = *(const int *) b;
+  return (x > y) - (x < y);
+}
+
+int wanted(int pid) {
+  return nonly == 0 || bsearch(&pid, only, nonly, sizeof(int), cmpint) != NULL;
+}
+
+int openstat(sampler *sm, int pid) {
+  char path[32];
+  int fd;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0 && (errno == EMFILE || errno == ENFILE)) sm->nofiles = 1;
+  return fd;
+}
+
+/*
+ * List the numeric entries of /proc into sm->pids, sorted
+ */
+void scanpids(sampler *sm) {
+  struct dirent *d;
+  const char *n;
+  int pid;
+
+  sm->npids = 0;
+  rewinddir(sm->dir);
+  while((d = readdir(sm->dir)) != NULL) {
+    pid = 0;
+    for(n = d->d_name; *n >= '0' && *n <= '9'; n++) pid = pid * 10 + (*n - '0');
+    if(*n != '\0' || n == d->d_name || !wanted(pid)) continue;
+
+    if(sm->npids == sm->pidcap) {
+      sm->pidcap = sm->pidcap ? sm->pidcap * 2 : 256;
+      sm->pids = realloc(sm->pids, sm->pidcap * sizeof(int));
+    }
+    sm->pids[sm->npids++] = pid;
+  }
+  qsort(sm->pids, sm->npids, sizeof(int), cmpint);
+}
+
+/*
+ * Bring the table in line with the latest scan: entries for pids that
+ * went away are closed and dropped, new pids get an entry. Both lists
+ * are sorted so this is a single merge pass done in place from the
+ * back.
+ */
+void mergepids(sampler *sm) {
+  int i, j, k, kept;
+
+  kept = 0;
+  for(i = 0, j = 0; i < sm->nprocs; i++) {
+    while(j < sm->npids && sm->pids[j] < sm->procs[i].pid) j++;
+    if(j < sm->npids && sm->pids[j] == sm->procs[i].pid) {
+      sm->procs[kept++] = sm->procs[i];
+    } else if(sm->procs[i].fd >= 0) {
+      close(sm->procs[i].fd);
+      sm->nofiles = 0;
+    }
+  }
+  sm->nprocs = kept;
+
+  if(sm->npids > sm->cap) {
+    sm->cap = sm->npids * 2;
+    sm->procs = realloc(sm->procs, sm->cap * sizeof(procentry));
+  }
+
+  i = sm->nprocs - 1;
+  k = sm->npids - 1;
+  for(j = sm->npids - 1; j >= 0; j--) {
+    if(i >= 0 && sm->procs[i].pid == sm->pids[j]) {
+      sm->procs[k--] = sm->procs[i--];
+    } else {
+      memset(&sm->procs[k], 0, sizeof(procentry));
+      sm->procs[k].pid = sm->pids[j];
+      sm->procs[k].fd = sm->nofiles ? -1 : openstat(sm, sm->pids[j]);
+      k--;
+    }
+  }
+  sm->nprocs = sm->npids;
+}
+
+/*
+ * Read and parse one entry. A pid can exit and be reused between the
+ * scan and the read, in which case the old file reads as an error and
+ * is reopened once to pick up the new process.
+ */
+int readentry(sampler *sm, procentry *e) {
+  ssize_t len;
+  int fd, retried = 0;
+
+again:
+  fd = e->fd >= 0 ? e->fd : openstat(sm, e->pid);
+  if(fd < 0) return 0;
+  len = pread(fd, sm->buf, sizeof(sm->buf), 0);
+  if(e->fd < 0) close(fd);
+
+  if(len <= 0) {
+    if(e->fd >= 0) {
+      close(e->fd);
+      e->fd = -1;
+      if(!retried++) { e->fd = openstat(sm, e->pid); goto again; }
+    }
+    return 0;
+  }
+  return parsestat(sm->buf, len, &e->stat) && e->stat.pid == e->pid;
+}
+
+/*
+ * Take one sample of every watched process. Entries that could not be
+ * read are left in the table with pid 0 in their stat and go away on
+ * the next scan.
+ */
+int takesample(sampler *sm) {
+  procentry *e;
+  int i, n = 0;
+
+  scanpids(sm);
+  mergepids(sm);
+
+  for(i = 0; i < sm->nprocs; i++) {
+    e = &sm->procs[i];
+    if(e->ignored) continue;
+
+    e->haveprev = e->stat.pid != 0;
+    if(e->haveprev) {
+      e->prev.start_time = e->stat.start_time;
+      e->prev.utime = e->stat.utime;
+      e->prev.stimev = e->stat.stimev;
+      e->prev.min_flt = e->stat.min_flt;
+      e->prev.maj_flt = e->stat.maj_flt;
+      e->prev.rss = e->stat.rss;
+    }
+
+    if(!readentry(sm, e)) { e->stat.pid = 0; continue; }
+    if(e->haveprev && e->prev.start_time != e->stat.start_time) e->haveprev = 0;
+
+    /*
+     * A process renamed by exec after it was first seen keeps the
+     * verdict it got then
+     */
+    if(match && !strstr(e->stat.tcomm, match)) {
+      e->ignored = 1;
+      e->stat.pid = 0;
+      if(e->fd >= 0) { close(e->fd); e->fd = -1; sm->nofiles = 0; }
+      continue;
+    }
+    n++;
+  }
+  return n;
+}
+
+double now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void printtable(sampler *sm) {
+  procentry *e;
+  int i;
+
+  printf("%7s %-16s %c %7s %10s %10s %10s %8s %10s\n",
+         "pid", "comm", 'S', "threads", "utime", "stime", "min_flt", "maj_flt", "rss");
+  for(i = 0; i < sm->nprocs; i++) {
+    e = &sm->procs[i];
+    if(e->stat.pid == 0) continue;
+    printf("%7lld %-16.16s %c %7lld %10.2f %10.2f %10lld %8lld %10lld\n",
+           e->stat.pid, e->stat.tcomm, e->stat.state, e->stat.num_threads,
+           (double) e->stat.utime / tickspersec, (double) e->stat.stimev / tickspersec,
+           e->stat.min_flt, e->stat.maj_flt, e->stat.rss);
+  }
+}
+
+/*
+ * Top mode: what each process did over the last interval
+ */
+typedef struct {
+  procentry *e;
+  double usr;     /* CPU %, user and system */
+  double sys;
+  double cpu;
+  double minflt;  /* Faults per second */
+  double majflt;
+  num rss;        /* KiB */
+  num drss;       /* KiB gained over the interval */
+} procrate;
+
+enum { BY_PID, BY_COMM, BY_CPU, BY_USR, BY_SYS, BY_MINFLT, BY_MAJFLT, BY_RSS, BY_DRSS };
+
+const char *columns[] = { "pid", "comm", "cpu", "usr", "sys", "minflt", "majflt", "rss", "drss" };
+
+#define NUM_COLUMNS (sizeof(columns) / sizeof(columns[0]))
+
+int sortby = BY_CPU;
+
+int setsortby(const char *name) {
+  int i;
+
+  for(sortby = 0; sortby < NUM_COLUMNS; sortby++)
+    if(strcmp(name, columns[sortby]) == 0) return 1;
+
+  fprintf(stderr, "Unknown column %s, use one of:", name);
+  for(i = 0; i < NUM_COLUMNS; i++) fprintf(stderr, " %s", columns[i]);
+  fprintf(stderr, "\n");
+  return 0;
+}
+
+/*
+ * pid and comm sort ascending, the rates busiest first
+ */
+int cmprate(const void *a, const void *b) {
+  const procrate *x = a, *y = b;
+  double d = 0;
+
+  switch(sortby) {
+  case BY_PID:    return (x->e->pid > y->e->pid) - (x->e->pid < y->e->pid);
+  case BY_COMM:   return strcmp(x->e->stat.tcomm, y->e->stat.tcomm);
+  case BY_CPU:    d = y->cpu - x->cpu; break;
+  case BY_USR:    d = y->usr - x->usr; break;
+  case BY_SYS:    d = y->sys - x->sys; break;
+  case BY_MINFLT: d = y->minflt - x->minflt; break;
+  case BY_MAJFLT: d = y->majflt - x->majflt; break;
+  case BY_RSS:    d = y->rss - x->rss; break;
+  case BY_DRSS:   d = y->drss - x->drss; break;
+  }
+  if(d == 0) return (x->e->pid > y->e->pid) - (x->e->pid < y->e->pid);
+  return d < 0 ? -1 : 1;
+}
+
+/*
+ * Print the rates of the processes seen in both of the last two
+ * samples, sorted by the -k column and cut off after lines rows.
+ * elapsed is the measured time between the samples.
+ */
+void printrates(sampler *sm, procrate *rates, int lines, int sample, double elapsed) {
+  long pagekb = pagesize / 1024;
+  double tps = tickspersec * elapsed / 100;
+  double total = 0;
+  procentry *e;
+  int i, n = 0;
+
+  for(i = 0; i < sm->nprocs; i++) {
+    e = &sm->procs[i];
+    if(e->stat.pid == 0 || !e->haveprev) continue;
+
+    rates[n].e = e;
+    rates[n].usr = (e->stat.utime - e->prev.utime) / tps;
+    rates[n].sys = (e->stat.stimev - e->prev.stimev) / tps;
+    rates[n].cpu = rates[n].usr + rates[n].sys;
+    rates[n].minflt = (e->stat.min_flt - e->prev.min_flt) / elapsed;
+    rates[n].majflt = (e->stat.maj_flt - e->prev.maj_flt) / elapsed;
+    rates[n].rss = e->stat.rss * pagekb;
+    rates[n].drss = (e->stat.rss - e->prev.rss) * pagekb;
+    total += rates[n].cpu;
+    n++;
+  }
+  qsort(rates, n, sizeof(procrate), cmprate);
+
+  printf("# sample %d: %d processes over %.3f s, %.1f%% cpu, sorted by %s\n",
+         sample, n, elapsed, total, columns[sortby]);
+  printf("%7s %-16s %c %6s %6s %6s %9s %9s %10s %9s\n", "pid", "comm", 'S',
+         "cpu%", "usr%", "sys%", "minflt/s", "majflt/s", "rss KiB", "drss KiB");
+  if(lines > 0 && n > lines) n = lines;
+  for(i = 0; i < n; i++) {
+    e = rates[i].e;
+    printf("%7d %-16.16s %c %6.1f %6.1f %6.1f %9.0f %9.0f %10lld %+9lld\n",
+           e->pid, e->stat.tcomm, e->stat.state, rates[i].cpu, rates[i].usr,
+           rates[i].sys, rates[i].minflt, rates[i].majflt, rates[i].rss, rates[i].drss);
+  }
+  printf("\n");
+}
+
+/*
+ * Snapshot files, written by -s -w and read back by -r.
+ *
+ * A file is a header, one record per sample and, once the writer has
+ * finished cleanly, an index and a trailer:
+ *
+ *   header   "PSNP", version byte, varint ticks per second, varint page size
+ *   record   'K' (keyframe) or 'D' (delta), varint payload length, payload
+ *   index    'I', varint payload length, payload
+ *   trailer  offset of the index as 8 little-endian bytes, then "PSIX"
+ *
+ * A sample's payload is its time in microseconds (since the epoch in a
+ * keyframe, since the previous sample in a delta), the number of
+ * processes, then for each process in pid order:
+ *
+ *   varint   pid minus the pid before it
+ *   byte     SNAP_NEW and SNAP_COMM flags
+ *   varint   start_time, if SNAP_NEW
+ *   byte     length then the name, if SNAP_COMM
+ *   byte     state
+ *   varints  the SNAP_VALUES counters, zigzag encoded: the values
+ *            themselves if SNAP_NEW, otherwise the change since the
+ *            previous sample
+ *
+ * Every process is SNAP_NEW in a keyframe, and in a delta when the
+ * previous sample did not have it. One sample in SNAP_KEYFRAME is a
+ * keyframe so a reader can start decoding there, and the index lists
+ * the keyframes. A file whose writer died has no trailer and is simply
+ * read from the start.
+ */
+#define SNAP_VERSION 1
+#define SNAP_KEYFRAME 64
+#define SNAP_NEW 1
+#define SNAP_COMM 2
+#define SNAP_TRAILER 12
+
+enum { V_PPID, V_THREADS, V_UTIME, V_STIME, V_MINFLT, V_MAJFLT, V_RSS, V_VSIZE, SNAP_VALUES };
+
+typedef struct {
+  int pid;
+  char state;
+  char tcomm[COMM_MAX];
+  unsigned long long start_time;
+  num v[SNAP_VALUES];
+} snaprow;
+
+typedef struct {
+  unsigned long long sample;  /* Sample number, counting from 0 */
+  unsigned long long time;    /* Microseconds since the epoch */
+  unsigned long long offset;  /* Where its record starts */
+} snapindex;
+
+void tosnap(procstat *s, snaprow *r) {
+  r->pid = s->pid;
+  r->state = s->state;
+  strcpy(r->tcomm, s->tcomm);
+  r->start_time = s->start_time;
+  r->v[V_PPID] = s->ppid;
+  r->v[V_THREADS] = s->num_threads;
+  r->v[V_UTIME] = s->utime;
+  r->v[V_STIME] = s->stimev;
+  r->v[V_MINFLT] = s->min_flt;
+  r->v[V_MAJFLT] = s->maj_flt;
+  r->v[V_RSS] = s->rss;
+  r->v[V_VSIZE] = s->vsize;
+}
+
+void fromsnap(snaprow *r, procstat *s) {
+  memset(s, 0, sizeof(procstat));
+  s->pid = r->pid;
+  s->state = r->state;
+  strcpy(s->tcomm, r->tcomm);
+  s->start_time = r->start_time;
+  s->ppid = r->v[V_PPID];
+  s->num_threads = r->v[V_THREADS];
+  s->utime = r->v[V_UTIME];
+  s->stimev = r->v[V_STIME];
+  s->min_flt = r->v[V_MINFLT];
+  s->maj_flt = r->v[V_MAJFLT];
+  s->rss = r->v[V_RSS];
+  s->vsize = r->v[V_VSIZE];
+}
+
+/*
+ * A growing byte buffer a record is built in
+ */
+typedef struct {
+  unsigned char *data;
+  size_t len;
+  size_t cap;
+} bytes;
+
+void putbyte(bytes *b, int c) {
+  if(b->len == b->cap) {
+    b->cap = b->cap ? b->cap * 2 : 4096;
+    b->data = realloc(b->data, b->cap);
+  }
+  b->data[b->len++] = c;
+}
+
+void putvar(bytes *b, unsigned long long v) {
+  while(v >= 0x80) { putbyte(b, (v & 0x7f) | 0x80); v >>= 7; }
+  putbyte(b, v);
+}
+
+void putsigned(bytes *b, num v) { putvar(b, ((unsigned long long) v << 1) ^ (unsigned long long) (v >> 63)); }
+
+int getbyte(cursor *c) {
+  if(c->p >= c->end) { c->bad = 1; return 0; }
+  return (unsigned char) *c->p++;
+}
+
+unsigned long long getvar(cursor *c) {
+  unsigned long long v = 0;
+  int shift = 0, b;
+
+  do {
+    if(shift > 63) { c->bad = 1; return 0; }
+    b = getbyte(c);
+    v |= (unsigned long long) (b & 0x7f) << shift;
+    shift += 7;
+  } while((b & 0x80) && !c->bad);
+  return v;
+}
+
+num getsigned(cursor *c) {
+  unsigned long long v = getvar(c);
+  return (num) (v >> 1) ^ -(num) (v & 1);
+}
+
+unsigned long long wallclock() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+typedef struct {
+  FILE *f;
+  bytes rec;
+  snaprow *prev;              /* The last sample written */
+  snaprow *cur;
+  int nprev;
+  int cap;
+  unsigned long long time;    /* Of the last sample */
+  unsigned long long offset;  /* Where the next record goes */
+  unsigned long long samples;
+  snapindex *index;
+  int nindex;
+} snapwriter;
+
+/*
+ * Write one record: type, payload length, then the payload in w->rec
+ */
+void writerecord(snapwriter *w, int type) {
+  bytes head = { 0 };
+
+  putbyte(&head, type);
+  putvar(&head, w->rec.len);
+  fwrite(head.data, 1, head.len, w->f);
+  fwrite(w->rec.data, 1, w->rec.len, w->f);
+  w->offset += head.len + w->rec.len;
+  free(head.data);
+}
+
+snapwriter *snapcreate(const char *path) {
+  snapwriter *w;
+
+  w = calloc(1, sizeof(snapwriter));
+  w->f = fopen(path, "wb");
+  if(!w->f) {
+    perror(path);
+    free(w);
+    return NULL;
+  }
+
+  putbyte(&w->rec, 'P'); putbyte(&w->rec, 'S'); putbyte(&w->rec, 'N'); putbyte(&w->rec, 'P');
+  putbyte(&w->rec, SNAP_VERSION);
+  putvar(&w->rec, tickspersec);
+  putvar(&w->rec, pagesize);
+  fwrite(w->rec.data, 1, w->rec.len, w->f);
+  w->offset = w->rec.len;
+  return w;
+}
+
+/*
+ * Append the processes of the latest sample. The record is flushed
+ * straight away so a crash loses at most the sample being written.
+ */
+void snapwrite(snapwriter *w, sampler *sm) {
+  unsigned long long t = wallclock();
+  int key = w->samples % SNAP_KEYFRAME == 0;
+  snaprow *r, *old, *tmp;
+  int i, j, k, n, pid, flags, len;
+
+  if(sm->nprocs > w->cap) {
+    w->cap = sm->nprocs * 2;
+    w->prev = realloc(w->prev, w->cap * sizeof(snaprow));
+    w->cur = realloc(w->cur, w->cap * sizeof(snaprow));
+  }
+  for(i = 0, n = 0; i < sm->nprocs; i++)
+    if(sm->procs[i].stat.pid != 0) tosnap(&sm->procs[i].stat, &w->cur[n++]);
+
+  w->rec.len = 0;
+  putvar(&w->rec, key ? t : t - w->time);
+  putvar(&w->rec, n);
+
+  for(i = 0, j = 0, pid = 0; i < n; i++) {
+    r = &w->cur[i];
+    while(j < w->nprev && w->prev[j].pid < r->pid) j++;
+    old = NULL;
+    if(!key && j < w->nprev && w->prev[j].pid == r->pid && w->prev[j].start_time == r->start_time)
+      old = &w->prev[j];
+
+    flags = old ? 0 : SNAP_NEW | SNAP_COMM;
+    if(old && strcmp(old->tcomm, r->tcomm) != 0) flags |= SNAP_COMM;
+
+    putvar(&w->rec, r->pid - pid);
+    pid = r->pid;
+    putbyte(&w->rec, flags);
+    if(flags & SNAP_NEW) putvar(&w->rec, r->start_time);
+    if(flags & SNAP_COMM) {
+      len = strlen(r->tcomm);
+      putbyte(&w->rec, len);
+      for(k = 0; k < len; k++) putbyte(&w->rec, r->tcomm[k]);
+    }
+    putbyte(&w->rec, r->state);
+    for(k = 0; k < SNAP_VALUES; k++) putsigned(&w->rec, old ? r->v[k] - old->v[k] : r->v[k]);
+  }
+
+  if(key) {
+    if((w->nindex & (w->nindex - 1)) == 0)
+      w->index = realloc(w->index, (w->nindex ? w->nindex * 2 : 1) * sizeof(snapindex));
+    w->index[w->nindex].sample = w->samples;
+    w->index[w->nindex].time = t;
+    w->index[w->nindex].offset = w->offset;
+    w->nindex++;
+  }
+  writerecord(w, key ? 'K' : 'D');
+  fflush(w->f);
+
+  tmp = w->prev; w->prev = w->cur; w->cur = tmp;
+  w->nprev = n;
+  w->time = t;
+  w->samples++;
+}
+
+/*
+ * Finish the file with the index and trailer, and free the writer
+ */
+void snapclose(snapwriter *w) {
+  unsigned long long at = w->offset;
+  snapindex last = { 0 };
+  int i;
+
+  w->rec.len = 0;
+  putvar(&w->rec, w->nindex);
+  for(i = 0; i < w->nindex; i++) {
+    putvar(&w->rec, w->index[i].sample - last.sample);
+    putvar(&w->rec, w->index[i].time - last.time);
+    putvar(&w->rec, w->index[i].offset - last.offset);
+    last = w->index[i];
+  }
+  writerecord(w, 'I');
+
+  w->rec.len = 0;
+  for(i = 0; i < 8; i++) putbyte(&w->rec, at >> (8 * i));
+  putbyte(&w->rec, 'P'); putbyte(&w->rec, 'S'); putbyte(&w->rec, 'I'); putbyte(&w->rec, 'X');
+  fwrite(w->rec.data, 1, w->rec.len, w->f);
+
+  fclose(w->f);
+  free(w->rec.data);
+  free(w->prev);
+  free(w->cur);
+  free(w->index);
+  free(w);
+}
+
+typedef struct {
+  const char *data;           /* The whole file, mapped */
+  size_t size;
+  cursor c;                   /* The next record */
+  const char *start;          /* The first record */
+  long tickspersec;
+  long pagesize;
+
+  snaprow *rows;              /* The latest sample */
+  snaprow *last;              /* The one before it */
+  snaprow *spare;
+  int nrows;
+  int nlast;
+  int cap;
+  unsigned long long time;    /* Of the latest sample */
+  unsigned long long sample;  /* Number of the next sample */
+
+  snapindex *index;
+  int nindex;
+} snapreader;
+
+snapreader *snapopen(const char *path) {
+  snapreader *r;
+  struct stat st;
+  const unsigned char *t;
+  unsigned long long at = 0, n;
+  snapindex last = { 0 };
+  cursor c;
+  int fd, i;
+
+  fd = open(path, O_RDONLY);
+  if(fd < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    if(fd >= 0) close(fd);
+    return NULL;
+  }
+
+  r = calloc(1, sizeof(snapreader));
+  r->size = st.st_size;
+  r->data = r->size ? mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  if(r->data == MAP_FAILED || r->size < 5 || memcmp(r->data, "PSNP", 4) != 0 || r->data[4] != SNAP_VERSION) {
+    fprintf(stderr, "%s: not a procstat snapshot\n", path);
+    if(r->data != MAP_FAILED) munmap((void *) r->data, r->size);
+    free(r);
+    return NULL;
+  }
+
+  c.p = r->data + 5;
+  c.end = r->data + r->size;
+  c.bad = 0;
+  r->tickspersec = getvar(&c);
+  r->pagesize = getvar(&c);
+  r->start = c.p;
+  r->c = c;
+
+  /*
+   * Load the index if the file was closed cleanly, and stop reading
+   * samples where it starts
+   */
+  t = (const unsigned char *) r->data + r->size - SNAP_TRAILER;
+  if(r->size >= SNAP_TRAILER + 5 && memcmp(t + 8, "PSIX", 4) == 0) {
+    for(i = 7; i >= 0; i--) at = at << 8 | t[i];
+    c.p = r->data + at;
+    c.end = (const char *) t;
+    if(at >= 5 && at < r->size && getbyte(&c) == 'I') {
+      /*
+       * The index is only trusted if it fits before the trailer, every
+       * entry takes at least three bytes, and every offset points at a
+       * sample. Otherwise the samples are read without it.
+       */
+      n = getvar(&c);
+      if(!c.bad && n <= (const char *) t - c.p) {
+        c.end = c.p + n;
+        n = getvar(&c);
+        if(!c.bad && n <= (c.end - c.p) / 3)
+          r->index = calloc(n + 1, sizeof(snapindex));
+        for(i = 0; r->index && i < n && !c.bad; i++) {
+          last.sample += getvar(&c);
+          last.time += getvar(&c);
+          last.offset += getvar(&c);
+          if(last.offset < r->start - r->data || last.offset > at) c.bad = 1;
+          r->index[i] = last;
+        }
+        if(r->index && !c.bad) {
+          r->nindex = n;
+          r->c.end = r->data + at;
+        } else {
+          free(r->index);
+          r->index = NULL;
+        }
+      }
+    }
+  }
+  return r;
+}
+
+void snapfree(snapreader *r) {
+  munmap((void *) r->data, r->size);
+  free(r->rows);
+  free(r->last);
+  free(r->spare);
+  free(r->index);
+  free(r);
+}
+
+/*
+ * Decode the next sample into r->rows, keeping the one before in
+ * r->last. Returns 1 for a sample, 0 at the end of the file and -1 if
+ * the file is damaged.
+ */
+int snapnext(snapreader *r) {
+  cursor c;
+  snaprow *row, *old, *tmp;
+  unsigned long long len, t;
+  int type, i, j, k, n, pid, flags;
+
+  if(r->c.p >= r->c.end) return 0;
+  type = getbyte(&r->c);
+  len = getvar(&r->c);
+  if(r->c.bad || len > r->c.end - r->c.p) return -1;
+  c.p = r->c.p;
+  c.end = r->c.p + len;
+  c.bad = 0;
+  r->c.p += len;
+
+  if(type == 'I') return 0;
+  if(type != 'K' && type != 'D') return -1;
+
+  t = getvar(&c);
+  n = getvar(&c);
+  if(c.bad || n < 0 || n > len) return -1;
+  if(n > r->cap) {
+    r->cap = n * 2;
+    r->rows = realloc(r->rows, r->cap * sizeof(snaprow));
+    r->last = realloc(r->last, r->cap * sizeof(snaprow));
+    r->spare = realloc(r->spare, r->cap * sizeof(snaprow));
+  }
+
+  for(i = 0, j = 0, pid = 0; i < n && !c.bad; i++) {
+    row = &r->spare[i];
+    pid += getvar(&c);
+    row->pid = pid;
+    flags = getbyte(&c);
+    if(flags & ~(SNAP_NEW | SNAP_COMM)) return -1;
+    if((flags & SNAP_NEW) && !(flags & SNAP_COMM)) return -1;
+
+    while(j < r->nrows && r->rows[j].pid < pid) j++;
+    old = NULL;
+    if(!(flags & SNAP_NEW)) {
+      if(type == 'K' || j == r->nrows || r->rows[j].pid != pid) return -1;
+      old = &r->rows[j];
+    }
+
+    row->start_time = old ? old->start_time : getvar(&c);
+    if(flags & SNAP_COMM) {
+      len = getbyte(&c);
+      if(len >= COMM_MAX || len > c.end - c.p) return -1;
+      memcpy(row->tcomm, c.p, len);
+      row->tcomm[len] = '\0';
+      c.p += len;
+    } else {
+      strcpy(row->tcomm, old->tcomm);
+    }
+    row->state = getbyte(&c);
+    for(k = 0; k < SNAP_VALUES; k++) row->v[k] = getsigned(&c) + (old ? old->v[k] : 0);
+  }
+  if(c.bad) return -1;
+
+  r->time = type == 'K' ? t : r->time + t;
+  tmp = r->last; r->last = r->rows; r->rows = r->spare; r->spare = tmp;
+  r->nlast = r->nrows;
+  r->nrows = n;
+  r->sample++;
+  return 1;
+}
+
+/*
+ * Position the reader so the next sample decoded is sample first, or
+ * the keyframe just before it. Without an index the file is read from
+ * the start.
+ */
+void snapseek(snapreader *r, unsigned long long first) {
+  int i;
+
+  for(i = r->nindex - 1; i >= 0; i--) {
+    if(r->index[i].sample <= first) {
+      r->c.p = r->data + r->index[i].offset;
+      r->sample = r->index[i].sample;
+      r->nrows = 0;
+      return;
+    }
+  }
+  r->c.p = r->start;
+  r->sample = 0;
+  r->nrows = 0;
+}
+
+/*
+ * Lay the latest sample out as a sampler table, with the sample before
+ * it as the previous counters, so the live printing code can show it
+ */
+void snaptable(snapreader *r, sampler *sm) {
+  procentry *e;
+  snaprow *old;
+  int i, j;
+
+  if(r->nrows > sm->cap) {
+    sm->cap = r->nrows * 2;
+    sm->procs = realloc(sm->procs, sm->cap * sizeof(procentry));
+  }
+
+  for(i = 0, j = 0; i < r->nrows; i++) {
+    e = &sm->procs[i];
+    memset(e, 0, sizeof(procentry));
+    e->pid = r->rows[i].pid;
+    e->fd = -1;
+    fromsnap(&r->rows[i], &e->stat);
+
+    while(j < r->nlast && r->last[j].pid < e->pid) j++;
+    old = j < r->nlast ? &r->last[j] : NULL;
+    if(old && old->pid == e->pid && old->start_time == e->stat.start_time) {
+      e->haveprev = 1;
+      e->prev.start_time = old->start_time;
+      e->prev.utime = old->v[V_UTIME];
+      e->prev.stimev = old->v[V_STIME];
+      e->prev.min_flt = old->v[V_MINFLT];
+      e->prev.maj_flt = old->v[V_MAJFLT];
+      e->prev.rss = old->v[V_RSS];
+    }
+  }
+  sm->nprocs = r->nrows;
+}
+
+/*
+ * Keeping thousands of stat files open needs more than the usual
+ * 1024 descriptors, so raise the soft limit as far as allowed
+ */
+void raisefdlimit() {
+  struct rlimit rl;
+
+  if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+}
+
+/*
+ * Set by SIGINT and SIGTERM so an endless -w run still gets to write
+ * its index
+ */
+volatile sig_atomic_t interrupted;
+
+void interrupt(int sig) { interrupted = 1; }
+
+int sample(int argc, char *argv[]) {
+  struct sigaction sa;
+  struct timespec next;
+  sampler *sm;
+  snapwriter *w = NULL;
+  const char *snapfile = NULL;
+  procrate *rates = NULL;
+  long interval = 100;
+  int samples = 0, quiet = 0, top = 0, lines = 20;
+  int i, n, opt;
+  double start, last = 0;
+
+  while((opt = getopt(argc, argv, "si:n:m:qtk:l:w:")) != -1) {
+    switch(opt) {
+    case 's': break;
+    case 'i': interval = atol(optarg); break;
+    case 'n': samples = atoi(optarg); break;
+    case 'm': match = optarg; break;
+    case 'q': quiet = 1; break;
+    case 't': top = 1; break;
+    case 'l': lines = atoi(optarg); break;
+    case 'k': if(setsortby(optarg)) break; return 1;
+    case 'w': snapfile = optarg; break;
+    default:
+      fprintf(stderr, "Usage: %s -s [-i msec] [-n samples] [-m name] [-q] [pid...]\n"
+              "       %s -s -t [-k column] [-l lines] [-i msec] [-n samples] [-m name] [pid...]\n"
+              "       %s -s -w file [-i msec] [-n samples] [-m name] [pid...]\n",
+              argv[0], argv[0], argv[0]);
+      return 1;
+    }
+  }
+  if(interval < 1) interval = 1;
+
+  /*
+   * When logging, the table goes to the file and only the per-sample
+   * summary is printed
+   */
+  if(snapfile) {
+    w = snapcreate(snapfile);
+    if(!w) return 1;
+    quiet = 1;
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = interrupt;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  /*
+   * In top mode the first sample only sets the baseline, so take one
+   * more to get samples intervals
+   */
+  if(top && samples) samples++;
+
+  nonly = argc - optind;
+  only = malloc((nonly + 1) * sizeof(int));
+  for(i = 0; i < nonly; i++) only[i] = atoi(argv[optind + i]);
+  qsort(only, nonly, sizeof(int), cmpint);
+
+  raisefdlimit();
+
+  sm = calloc(1, sizeof(sampler));
+  sm->dir = opendir("/proc");
+  if(!sm->dir) {
+    perror("/proc");
+    return 1;
+  }
+
+  /*
+   * Sleep to absolute deadlines so the time spent sampling does not
+   * stretch the interval
+   */
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  for(i = 1; !interrupted && (samples == 0 || i <= samples); i++) {
+    start = now();
+    n = takesample(sm);
+    if(w) snapwrite(w, sm);
+    if(!top) {
+      printf("# sample %d: %d processes in %.0f us\n", i, n, (now() - start) * 1e6);
+      if(!quiet) printtable(sm);
+    } else if(i > 1) {
+      rates = realloc(rates, sm->nprocs * sizeof(procrate));
+      printrates(sm, rates, lines, i - 1, start - last);
+    }
+    last = start;
+    fflush(stdout);
+
+    if(samples != 0 && i == samples) break;
+    next.tv_nsec += (interval % 1000) * 1000000;
+    next.tv_sec += interval / 1000 + next.tv_nsec / 1000000000;
+    next.tv_nsec %= 1000000000;
+    while(!interrupted && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR);
+  }
+
+  if(w) snapclose(w);
+
+  for(i = 0; i < sm->nprocs; i++)
+    if(sm->procs[i].fd >= 0) close(sm->procs[i].fd);
+  closedir(sm->dir);
+  free(sm->procs);
+  free(sm->pids);
+  free(sm);
+  free(rates);
+  free(only);
+  return 0;
+}
+
+/*
+ * Replay aggregation: one line per process over the whole replay
+ */
+typedef struct {
+  int pid;
+  unsigned long long start_time;
+  char tcomm[COMM_MAX];
+  unsigned long long first;   /* When it was first and last seen */
+  unsigned long long last;
+  int samples;
+  num cpu0, cpu;              /* utime + stime when first and last seen */
+  num minflt0, minflt;
+  num majflt0, majflt;
+  num maxrss;
+} snapagg;
+
+int cmpagg(const void *a, const void *b) {
+  const snapagg *x = a, *y = b;
+  num dx = x->cpu - x->cpu0, dy = y->cpu - y->cpu0;
+
+  if(dx != dy) return dx < dy ? 1 : -1;
+  return (x->pid > y->pid) - (x->pid < y->pid);
+}
+
+/*
+ * Fold the latest sample into the aggregate table. Both are sorted by
+ * pid then start_time, so this is one merge into a fresh table.
+ */
+snapagg *aggregate(snapreader *r, snapagg *agg, int *nagg, snapagg **spare, int *cap) {
+  snapagg *out, *a;
+  snaprow *row;
+  int i = 0, j = 0, n = 0;
+  num cpu;
+
+  if(*nagg + r->nrows > *cap) {
+    *cap = (*nagg + r->nrows) * 2;
+    agg = realloc(agg, *cap * sizeof(snapagg));
+    *spare = realloc(*spare, *cap * sizeof(snapagg));
+  }
+  out = *spare;
+
+  while(i < *nagg || j < r->nrows) {
+    row = j < r->nrows ? &r->rows[j] : NULL;
+    if(!row || (i < *nagg && (agg[i].pid < row->pid ||
+                              (agg[i].pid == row->pid && agg[i].start_time < row->start_time)))) {
+      out[n++] = agg[i++];
+      continue;
+    }
+
+    cpu = row->v[V_UTIME] + row->v[V_STIME];
+    a = &out[n++];
+    if(i < *nagg && agg[i].pid == row->pid && agg[i].start_time == row->start_time) {
+      *a = agg[i++];
+    } else {
+      memset(a, 0, sizeof(snapagg));
+      a->pid = row->pid;
+      a->start_time = row->start_time;
+      a->first = r->time;
+      a->cpu0 = cpu;
+      a->minflt0 = row->v[V_MINFLT];
+      a->majflt0 = row->v[V_MAJFLT];
+    }
+    strcpy(a->tcomm, row->tcomm);
+    a->last = r->time;
+    a->samples++;
+    a->cpu = cpu;
+    a->minflt = row->v[V_MINFLT];
+    a->majflt = row->v[V_MAJFLT];
+    if(row->v[V_RSS] > a->maxrss) a->maxrss = row->v[V_RSS];
+    j++;
+  }
+
+  *spare = agg;
+  *nagg = n;
+  return out;
+}
+
+void printagg(snapreader *r, snapagg *agg, int n, int lines) {
+  long pagekb = r->pagesize / 1024;
+  double span, cpu;
+  int i;
+
+  qsort(agg, n, sizeof(snapagg), cmpagg);
+  printf("%7s %-16s %8s %9s %10s %6s %10s %9s %10s\n", "pid", "comm", "samples",
+         "seen s", "cpu s", "cpu%", "minflt", "majflt", "maxrss KiB");
+  if(lines > 0 && n > lines) n = lines;
+  for(i = 0; i < n; i++) {
+    span = (agg[i].last - agg[i].first) / 1e6;
+    cpu = (double) (agg[i].cpu - agg[i].cpu0) / r->tickspersec;
+    printf("%7d %-16.16s %8d %9.1f %10.2f %6.1f %10lld %9lld %10lld\n", agg[i].pid,
+           agg[i].tcomm, agg[i].samples, span, cpu, span > 0 ? 100 * cpu / span : 0.0,
+           agg[i].minflt - agg[i].minflt0, agg[i].majflt - agg[i].majflt0,
+           agg[i].maxrss * pagekb);
+  }
+}
+
+int replay(int argc, char *argv[]) {
+  snapreader *r;
+  sampler *sm;
+  procrate *rates = NULL;
+  snapagg *agg = NULL, *spare = NULL;
+  const char *path = NULL;
+  unsigned long long first = 0, prevtime = 0;
+  long long count = -1;
+  int quiet = 0, top = 0, totals = 0, lines = 20, nagg = 0, aggcap = 0, shown = 0;
+  int opt, ret, n, i;
+  char when[64];
+  time_t secs;
+
+  while((opt = getopt(argc, argv, "r:qtk:l:af:n:")) != -1) {
+    switch(opt) {
+    case 'r': path = optarg; break;
+    case 'q': quiet = 1; break;
+    case 't': top = 1; break;
+    case 'l': lines = atoi(optarg); break;
+    case 'a': totals = 1; break;
+    case 'f': first = strtoull(optarg, NULL, 10); break;
+    case 'n': count = atoll(optarg); break;
+    case 'k': if(setsortby(optarg)) break; return 1;
+    default:
+      fprintf(stderr, "Usage: %s -r file [-q] [-t [-k column]] [-a] [-l lines] [-f first] [-n samples]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  r = snapopen(path);
+  if(!r) return 1;
+  tickspersec = r->tickspersec;
+  pagesize = r->pagesize;
+  sm = calloc(1, sizeof(sampler));
+
+  /*
+   * Rates need the sample before the first one shown
+   */
+  snapseek(r, top && first > 0 ? first - 1 : first);
+
+  while(count < 0 || shown < count) {
+    ret = snapnext(r);
+    if(ret < 0) {
+      fprintf(stderr, "%s: sample %llu is damaged or cut short\n", path, r->sample);
+      break;
+    }
+    if(ret == 0) break;
+    if(r->sample - 1 < first || (top && r->nlast == 0)) {
+      prevtime = r->time;
+      continue;
+    }
+    shown++;
+
+    if(totals) {
+      agg = aggregate(r, agg, &nagg, &spare, &aggcap);
+    } else if(top) {
+      snaptable(r, sm);
+      rates = realloc(rates, (sm->nprocs + 1) * sizeof(procrate));
+      printrates(sm, rates, lines, r->sample - 1, (r->time - prevtime) / 1e6);
+    } else {
+      snaptable(r, sm);
+      secs = r->time / 1000000;
+      strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+      for(i = 0, n = 0; i < sm->nprocs; i++) n += sm->procs[i].stat.pid != 0;
+      printf("# sample %llu at %s.%06llu: %d processes\n", r->sample - 1, when, r->time % 1000000, n);
+      if(!quiet) printtable(sm);
+    }
+    prevtime = r->time;
+  }
+
+  if(totals) printagg(r, agg, nagg, lines);
+
+  snapfree(r);
+  free(sm->procs);
+  free(sm);
+  free(rates);
+  free(agg);
+  free(spare);
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
+  static char buf[STAT_BUF];
+  procstat s;
+  ssize_t len, got;
+  int fd;
+
   tickspersec = sysconf(_SC_CLK_TCK);
-  input = NULL;
+  pagesize = sysconf(_SC_PAGESIZE);
+
+  if(argc > 1 && strcmp(argv[1], "-s") == 0) return sample(argc, argv);
+  if(argc > 1 && strncmp(argv[1], "-r", 2) == 0) return replay(argc, argv);
 
   if(argc > 1) {
+    fd = -1;
     chdir("/proc");
-    if(chdir(argv[1]) == 0) { input = fopen("stat", "r"); }
-    if(!input) {
+    if(chdir(argv[1]) == 0) { fd = open("stat", O_RDONLY); }
+    if(fd < 0) {
       perror("open");
       return 1;
     }
   } else {
-    input = stdin;
-  }
-
-
-  readone(&pid);
-  readstr(tcomm);
-  readchar(&state);
-  readone(&ppid);
-  readone(&pgid);
-  readone(&sid);
-  readone(&tty_nr);
-  readone(&tty_pgrp);
-  readone(&flags);
-  readone(&min_flt);
-  readone(&cmin_flt);
-  readone(&maj_flt);
-  readone(&cmaj_flt);
-  readone(&utime);
-  readone(&stimev);
-  readone(&cutime);
-  readone(&cstime);
-  readone(&priority);
-  readone(&nicev);
-  readone(&num_threads);
-  readone(&it_real_value);
-  readunsigned(&start_time);
-  readone(&vsize);
-  readone(&rss);
-  readone(&rsslim);
-  readone(&start_code);
-  readone(&end_code);
-  readone(&start_stack);
-  readone(&esp);
-  readone(&eip);
-  readone(&pending);
-  readone(&blocked);
-  readone(&sigign);
-  readone(&sigcatch);
-  readone(&wchan);
-  readone(&zero1);
-  readone(&zero2);
-  readone(&exit_signal);
-  readone(&cpu);
-  readone(&rt_priority);
-  readone(&policy);
-
-  {
-
-    printone("pid", pid);
-    printstr("tcomm", tcomm);
-    printchar("state", state);
-    printone("ppid", ppid);
-    printone("pgid", pgid);
-    printone("sid", sid);
-    printone("tty_nr", tty_nr);
-    printone("tty_pgrp", tty_pgrp);
-    printone("flags", flags);
-    printone("min_flt", min_flt);
-    printone("cmin_flt", cmin_flt);
-    printone("maj_flt", maj_flt);
-    printone("cmaj_flt", cmaj_flt);
-    printtime("utime", utime);
-    printtime("stime", stimev);
-    printtime("cutime", cutime);
-    printtime("cstime", cstime);
-    printone("priority", priority);
-    printone("nice", nicev);
-    printone("num_threads", num_threads);
-    printtime("it_real_value", it_real_value);
-    printtimediff("start_time", start_time);
-    printone("vsize", vsize);
-    printone("rss", rss);
-    printone("rsslim", rsslim);
-    printone("start_code", start_code);
-    printone("end_code", end_code);
-    printone("start_stack", start_stack);
-    printone("esp", esp);
-    printone("eip", eip);
-    printonex("pending", pending);
-    printonex("blocked", blocked);
-    printonex("sigign", sigign);
-    printonex("sigcatch", sigcatch);
-    printone("wchan", wchan);
-    printone("zero1", zero1);
-    printone("zero2", zero2);
-    printonex("exit_signal", exit_signal);
-    printone("cpu", cpu);
-    printone("rt_priority", rt_priority);
-    printone("policy", policy);
+    fd = STDIN_FILENO;
   }
 
+  /*
+   * A pipe may hand the line over in pieces, so read until end of file
+   */
+  len = 0;
+  while(len < sizeof(buf) && (got = read(fd, buf + len, sizeof(buf) - len)) > 0) len += got;
+  if(fd != STDIN_FILENO) close(fd);
+
+  if(!parsestat(buf, len, &s)) {
+    fprintf(stderr, "not a stat line\n");
+    return 1;
+  }
+  printstat(&s);
+
   return 0;
 }
-
@@ -0,0 +1,341 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "watchdog.h"
+
+#define gettid() syscall(SYS_gettid)
+
+/*
+ * Big enough for /proc/.../status, the larger of the two files
+ */
+#define WATCHDOG_BUF 4096
+
+/*
+ * utime is field 14 of stat, the 12th after the ")" closing comm
+ */
+#define UTIME_FIELD 12
+
+typedef struct {
+  pid_t tid;
+  int stat_fd;              /* Kept open, re-read with pread */
+  int status_fd;
+  watchdog_counts counts;
+  struct timespec progress; /* When this thread last made progress */
+} watched;
+
+struct watchdog {
+  pthread_mutex_t lock;
+  pthread_cond_t  wake;     /* Signalled to stop the watchdog thread */
+  pthread_t       thread;
+  int             running;
+  int             stop;
+
+  long            interval_ms;
+  long            stall_ms;
+  int             mode;
+  watchdog_fn     fn;
+  void           *arg;
+
+  watched        *threads;
+  int             nthreads;
+  int             cap;
+  int             all_stalled;
+
+  char            buf[WATCHDOG_BUF];
+};
+
+static long ms_since (struct timespec *then, struct timespec *now)
+{
+  return (now->tv_sec - then->tv_sec) * 1000 +
+         (now->tv_nsec - then->tv_nsec) / 1000000;
+}
+
+/*
+ * Read a whole /proc file into wd->buf with one pread. Returns its
+ * length, or -1 once the thread is gone.
+ */
+static int read_proc (watchdog *wd, int fd)
+{
+  ssize_t len;
+
+  len = pread(fd, wd->buf, sizeof(wd->buf) - 1, 0);
+  if (len <= 0)
+    return -1;
+  wd->buf[len] = '\0';
+  return len;
+}
+
+/*
+ * Pull utime and stime out of a stat line. comm can hold spaces and
+ * parentheses, so counting starts after the last ")".
+ */
+static int parse_stat (char *buf, unsigned long *utime, unsigned long *stime)
+{
+  char *p;
+  int field;
+
+  p = strrchr(buf, ')');
+  if (p == NULL)
+    return -1;
+
+  for (field = 0; field < UTIME_FIELD; field++) {
+    p = strchr(p + 1, ' ');
+    if (p == NULL)
+      return -1;
+  }
+
+  *utime = strtoul(p + 1, &p, 10);
+  *stime = strtoul(p, NULL, 10);
+  return 0;
+}
+
+static int parse_status (char *buf, unsigned long *vcsw)
+{
+  char *p;
+
+  p = strstr(buf, "\nvoluntary_ctxt_switches:");
+  if (p == NULL)
+    return -1;
+  *vcsw = strtoul(p + strlen("\nvoluntary_ctxt_switches:"), NULL, 10);
+  return 0;
+}
+
+/*
+ * Take one sample of every thread and work out who is stalled. Called
+ * with wd->lock held. Fills stalled[] with the indexes to call back
+ * for and returns how many there are.
+ */
+static int sample (watchdog *wd, int *stalled)
+{
+  struct timespec now;
+  unsigned long utime, stime, vcsw;
+  watched *t;
+  int i, n = 0, live = 0, all = 1;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  for (i = 0; i < wd->nthreads; i++) {
+    t = &wd->threads[i];
+    if (t->counts.gone)
+      continue;
+
+    if (read_proc(wd, t->stat_fd) < 0 || parse_stat(wd->buf, &utime, &stime) ||
+        read_proc(wd, t->status_fd) < 0 || parse_status(wd->buf, &vcsw)) {
+      t->counts.gone = 1;
+      close(t->stat_fd);
+      close(t->status_fd);
+      continue;
+    }
+    live++;
+
+    if (utime != t->counts.utime || stime != t->counts.stime ||
+        vcsw != t->counts.vcsw) {
+      t->counts.utime = utime;
+      t->counts.stime = stime;
+      t->counts.vcsw = vcsw;
+      t->counts.stalled = 0;
+      t->progress = now;
+    } else if (ms_since(&t->progress, &now) >= wd->stall_ms) {
+      if (!t->counts.stalled && wd->mode == WATCHDOG_ANY)
+        stalled[n++] = i;
+      t->counts.stalled = 1;
+    }
+
+    if (!t->counts.stalled)
+      all = 0;
+  }
+
+  if (wd->mode == WATCHDOG_ALL) {
+    if (live > 0 && all && !wd->all_stalled)
+      stalled[n++] = -1;
+    wd->all_stalled = live > 0 && all;
+  }
+  return n;
+}
+
+static void *watchdog_thread (void *arg)
+{
+  watchdog *wd = arg;
+  struct timespec next;
+  int *stalled = NULL, *grown;
+  int i, n;
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
+  pthread_mutex_lock(&wd->lock);
+  while (!wd->stop) {
+    /*
+     * Room for every thread plus the WATCHDOG_ALL entry. If it cannot
+     * grow, this round's sample is skipped and tried again next time.
+     */
+    grown = realloc(stalled, (wd->nthreads + 1) * sizeof(int));
+    if (grown != NULL) {
+      stalled = grown;
+      n = sample(wd, stalled);
+    } else {
+      n = 0;
+    }
+
+    /*
+     * Call back without the lock so the callback can look at the
+     * counters
+     */
+    if (n > 0) {
+      pthread_mutex_unlock(&wd->lock);
+      for (i = 0; i < n; i++)
+        wd->fn(wd, stalled[i], wd->arg);
+      pthread_mutex_lock(&wd->lock);
+    }
+
+    /*
+     * Sleep to absolute deadlines so sampling time does not stretch
+     * the interval
+     */
+    next.tv_sec += wd->interval_ms / 1000;
+    next.tv_nsec += (wd->interval_ms % 1000) * 1000000;
+    if (next.tv_nsec >= 1000000000) {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000;
+    }
+    while (!wd->stop &&
+           pthread_cond_timedwait(&wd->wake, &wd->lock, &next) != ETIMEDOUT)
+      ;
+  }
+  pthread_mutex_unlock(&wd->lock);
+
+  free(stalled);
+  return NULL;
+}
+
+watchdog *watchdog_create (long interval_ms, long stall_ms, int mode,
+                           watchdog_fn fn, void *arg)
+{
+  pthread_condattr_t attr;
+  watchdog *wd;
+
+  if (interval_ms < 1 || stall_ms < interval_ms || fn == NULL)
+    return NULL;
+
+  wd = calloc(1, sizeof(watchdog));
+  if (wd == NULL)
+    return NULL;
+
+  wd->interval_ms = interval_ms;
+  wd->stall_ms = stall_ms;
+  wd->mode = mode;
+  wd->fn = fn;
+  wd->arg = arg;
+
+  pthread_mutex_init(&wd->lock, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&wd->wake, &attr);
+  pthread_condattr_destroy(&attr);
+
+  return wd;
+}
+
+int watchdog_add (watchdog *wd, pid_t tid)
+{
+  char filename[64];
+  watched *t;
+  int idx;
+
+  if (tid == 0)
+    tid = gettid();
+
+  pthread_mutex_lock(&wd->lock);
+
+  if (wd->nthreads == wd->cap) {
+    t = realloc(wd->threads, (wd->cap ? wd->cap * 2 : 8) * sizeof(watched));
+    if (t == NULL) {
+      pthread_mutex_unlock(&wd->lock);
+      return -1;
+    }
+    wd->threads = t;
+    wd->cap = wd->cap ? wd->cap * 2 : 8;
+  }
+
+  t = &wd->threads[wd->nthreads];
+  memset(t, 0, sizeof(watched));
+  t->tid = tid;
+
+  snprintf(filename, sizeof(filename), "/proc/self/task/%d/stat", tid);
+  t->stat_fd = open(filename, O_RDONLY | O_CLOEXEC);
+  snprintf(filename, sizeof(filename), "/proc/self/task/%d/status", tid);
+  t->status_fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+  if (t->stat_fd < 0 || t->status_fd < 0) {
+    if (t->stat_fd >= 0)
+      close(t->stat_fd);
+    if (t->status_fd >= 0)
+      close(t->status_fd);
+    pthread_mutex_unlock(&wd->lock);
+    return -1;
+  }
+
+  /*
+   * A new thread has had no chance to stall yet
+   */
+  clock_gettime(CLOCK_MONOTONIC, &t->progress);
+  idx = wd->nthreads++;
+  pthread_mutex_unlock(&wd->lock);
+  return idx;
+}
+
+int watchdog_start (watchdog *wd)
+{
+  int err;
+
+  pthread_mutex_lock(&wd->lock);
+  err = wd->running ? 0 : pthread_create(&wd->thread, NULL, watchdog_thread, wd);
+  if (err == 0)
+    wd->running = 1;
+  pthread_mutex_unlock(&wd->lock);
+  return err ? -1 : 0;
+}
+
+int watchdog_get (watchdog *wd, int idx, watchdog_counts *out)
+{
+  int ret = -1;
+
+  pthread_mutex_lock(&wd->lock);
+  if (idx >= 0 && idx < wd->nthreads) {
+    *out = wd->threads[idx].counts;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&wd->lock);
+  return ret;
+}
+
+void watchdog_destroy (watchdog *wd)
+{
+  int i;
+
+  pthread_mutex_lock(&wd->lock);
+  wd->stop = 1;
+  pthread_cond_signal(&wd->wake);
+  pthread_mutex_unlock(&wd->lock);
+
+  if (wd->running)
+    pthread_join(wd->thread, NULL);
+
+  for (i = 0; i < wd->nthreads; i++) {
+    if (!wd->threads[i].counts.gone) {
+      close(wd->threads[i].stat_fd);
+      close(wd->threads[i].status_fd);
+    }
+  }
+
+  pthread_cond_destroy(&wd->wake);
+  pthread_mutex_destroy(&wd->lock);
+  free(wd->threads);
+  free(wd);
+}
@@ -0,0 +1,71 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <sys/types.h>
+
+/*
+ * In-process watchdog. A background thread samples the CPU time and
+ * voluntary context switches of every registered thread from
+ * /proc/self/task/<tid>, and calls back when threads stop making
+ * progress. A thread counts as making progress over an interval if it
+ * ran (utime or stime grew) or blocked and was woken again (its
+ * voluntary context switches grew).
+ */
+typedef struct watchdog watchdog;
+
+/*
+ * Which stalls are reported. WATCHDOG_ALL calls back once when every
+ * registered thread has stalled, the way a deadlock looks, with idx
+ * -1. WATCHDOG_ANY calls back for each thread that stalls on its own,
+ * with that thread's index.
+ */
+#define WATCHDOG_ALL 0
+#define WATCHDOG_ANY 1
+
+/*
+ * Called from the watchdog thread, without the watchdog locked, so it
+ * may use watchdog_get(). It is called once per stall and again only
+ * after progress resumes and stops again.
+ */
+typedef void (*watchdog_fn) (watchdog *wd, int idx, void *arg);
+
+/*
+ * Cumulative counters of one thread at the latest sample. Times are in
+ * clock ticks.
+ */
+typedef struct {
+  unsigned long utime;
+  unsigned long stime;
+  unsigned long vcsw;
+  int stalled;
+  int gone;       /* The thread has exited */
+} watchdog_counts;
+
+/*
+ * Create a watchdog that samples every interval_ms and declares a
+ * stall after stall_ms without progress. Returns NULL on failure.
+ */
+watchdog *watchdog_create (long interval_ms, long stall_ms, int mode,
+                           watchdog_fn fn, void *arg);
+
+/*
+ * Watch thread tid of this process, or the calling thread if tid is
+ * 0. Threads may be added before or after watchdog_start(). Returns the
+ * thread's index, or -1 if its /proc files cannot be opened.
+ */
+int watchdog_add (watchdog *wd, pid_t tid);
+
+int watchdog_start (watchdog *wd);
+
+/*
+ * Copy the latest counters of thread idx into out. Returns -1 for an
+ * unknown index.
+ */
+int watchdog_get (watchdog *wd, int idx, watchdog_counts *out);
+
+/*
+ * Stop the watchdog thread, close every file and free the watchdog
+ */
+void watchdog_destroy (watchdog *wd);
+
+#endif
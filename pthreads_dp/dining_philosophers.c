@@ -4,6 +4,8 @@
 #include <math.h>
 #include <stdlib.h>
 
+#include "dp_rand.h"
+
 /*
  * Some handy constants. Number of philosophers and chopsticks lets us
  * parameterize the number of concurrent threads and shared
@@ -42,6 +44,7 @@ typedef struct {
 /* GLOBALS */
 philosopher Diners[NUM_PHILS];
 int         Stop = 0;
+uint64_t    Seed;
 
 /* Each chopstick is shared between two philosophers */
 static pthread_mutex_t chopstick[NUM_CHOPS];
@@ -122,9 +125,11 @@ static void *dp_thread(void *arg)
   int          i;
   int          id;
   philosopher *me;
+  dp_rand      rng;
   int          think_rnd;
 
   me = (philosopher *) arg;
+  dp_rand_seed(&rng, Seed, me->id);
   id = me->id;
 
   /*
@@ -136,8 +141,8 @@ static void *dp_thread(void *arg)
      * Determine how long to think and eat in this cycle. Limit the
      * values to defined maximum values.
      */
-    think_rnd = (rand() % MAX_PHIL_THINK_PERIOD);
-    eat_rnd   = (rand() % MAX_PHIL_EAT_PERIOD);
+    think_rnd = dp_rand_below(&rng, MAX_PHIL_THINK_PERIOD);
+    eat_rnd   = dp_rand_below(&rng, MAX_PHIL_EAT_PERIOD);
 
     /*
      * Think a random number of thoughts before getting hungry. this
@@ -295,10 +300,10 @@ int main(int argc, char **argv)
   iter = 0;
 
   /*
-   * Randomly seed the random number generator used to control how
-   * long philosophers eat and think.
+   * Pick the seed the philosophers' random number generators start
+   * from. They control how long philosophers eat and think.
    */
-  srand(time(NULL));
+  Seed = time(NULL);
 
   /*
    * Set the table means create the chopsticks and the philosophers.
@@ -0,0 +1,620 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "dp_chopword.h"
+#include "dp_rand.h"
+
+/*
+ * Benchmark harness for the dining philosophers solutions. Each
+ * strategy runs for a fixed time on the same table, and the harness
+ * reports meals/sec, how long philosophers waited for their
+ * chopsticks, how evenly the meals were shared, and the longest any
+ * philosopher went without eating.
+ *
+ * The thinking and eating loops are the same as in the lab programs,
+ * so the numbers are comparable with theirs.
+ */
+#define NUM_PHILS                     5
+#define MAX_PHIL_THINK_PERIOD      1000
+#define MAX_PHIL_EAT_PERIOD         100
+#define RUN_SECONDS                   5
+#define MAX_PRINTED_PHILS            20
+
+/*
+ * Wait times are counted in power of two buckets of nanoseconds:
+ * bucket i holds waits of at least 2^i and less than 2^(i+1) ns, and
+ * the last bucket everything longer
+ */
+#define HIST_BUCKETS                 36
+
+/*
+ * How long a philosopher blocked on a chopstick mutex sleeps before
+ * checking whether the run is over. It only matters once a run
+ * deadlocks.
+ */
+#define STOP_CHECK_NS          10000000
+
+/*
+ * Structure defining a philosopher and everything measured about it
+ */
+typedef struct {
+  int            id;           /* Int ID number assigned by
+                                  set_table() */
+  pthread_cond_t can_eat;      /* Condition var used in a WAITER SOLUTION */
+  pthread_t      thread;       /* Thread structure for this
+                                  philosopher */
+
+  long           meals;        /* Meals eaten this run */
+  long           hist[HIST_BUCKETS];  /* Histogram of wait times */
+  uint64_t       wait_total;   /* Nanoseconds spent waiting */
+  uint64_t       wait_max;     /* Longest single wait */
+  uint64_t       last_meal;    /* When the last meal started */
+  uint64_t       starve_max;   /* Longest time between meals */
+} philosopher;
+
+/*
+ * A solution is a way to pick up both chopsticks and a way to put
+ * them down. pick_up returns 0 if it gave up because the run is over.
+ */
+typedef struct {
+  const char *name;
+  int  (*pick_up)(philosopher *me);
+  void (*put_down)(philosopher *me);
+} strategy;
+
+/* GLOBALS */
+philosopher *Diners;
+int          Num_Phils = NUM_PHILS;
+int          Num_Chops = NUM_PHILS;
+atomic_int   Stop;
+uint64_t     Seed;
+
+/* Each chopstick is shared between two philosophers */
+static pthread_mutex_t *chopstick;
+
+/* WAITER SOLUTION uses these data structures */
+static pthread_mutex_t waiter;
+static int *available_chopsticks;
+
+/*
+ * Helper functions for grabbing chopsticks, referencing neighbors.
+ * The numbering is the same as in the lab programs.
+ */
+philosopher *left_phil (philosopher *p)
+{
+  return &Diners[(p->id == (Num_Phils-1) ? 0 : (p->id)+1)];
+}
+
+philosopher *right_phil (philosopher *p)
+{
+  return &Diners[(p->id == 0 ? (Num_Phils-1) : (p->id)-1)];
+}
+
+int left_chop_num (philosopher *p)
+{
+  return p->id;
+}
+
+int right_chop_num (philosopher *p)
+{
+  return (p->id == 0 ? Num_Chops-1 : (p->id)-1);
+}
+
+/*
+ * Current time in nanoseconds
+ */
+uint64_t now_ns()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void think_one_thought()
+{
+  int i;
+  i = 0;
+  i++;
+}
+
+void eat_one_mouthful()
+{
+  int i;
+  i = 0;
+  i++;
+}
+
+/*
+ * Lock a chopstick mutex, giving up if the run ends first. A naive
+ * table that deadlocked would otherwise never let its philosophers
+ * go home.
+ */
+int chop_lock(pthread_mutex_t *m)
+{
+  struct timespec ts;
+
+  while (1) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += STOP_CHECK_NS;
+    if (ts.tv_nsec >= 1000000000) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000;
+    }
+
+    if (pthread_mutex_timedlock(m, &ts) == 0)
+      return 1;
+    if (atomic_load(&Stop))
+      return 0;
+  }
+}
+
+/*
+ * NAIVE SOLUTION: left chopstick, then right. Deadlocks as soon as
+ * every philosopher holds a left chopstick.
+ */
+int naive_pick_up(philosopher *me)
+{
+  if (!chop_lock(&chopstick[left_chop_num(me)]))
+    return 0;
+
+  if (!chop_lock(&chopstick[right_chop_num(me)])) {
+    pthread_mutex_unlock(&chopstick[left_chop_num(me)]);
+    return 0;
+  }
+  return 1;
+}
+
+void naive_put_down(philosopher *me)
+{
+  pthread_mutex_unlock(&chopstick[right_chop_num(me)]);
+  pthread_mutex_unlock(&chopstick[left_chop_num(me)]);
+}
+
+/*
+ * ASYMMETRIC SOLUTION: even philosophers start with the left
+ * chopstick and odd ones with the right, which breaks the cycle
+ */
+int asymmetric_pick_up(philosopher *me)
+{
+  int first, second;
+
+  first  = (me->id % 2 == 0) ? left_chop_num(me) : right_chop_num(me);
+  second = (me->id % 2 == 0) ? right_chop_num(me) : left_chop_num(me);
+
+  if (!chop_lock(&chopstick[first]))
+    return 0;
+
+  if (!chop_lock(&chopstick[second])) {
+    pthread_mutex_unlock(&chopstick[first]);
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * WAITER SOLUTION: one mutex guards the available flags of every
+ * chopstick
+ */
+int waiter_pick_up(philosopher *me)
+{
+  pthread_mutex_lock(&waiter);
+
+  while (!(available_chopsticks[left_chop_num(me)] &&
+           available_chopsticks[right_chop_num(me)]))
+    pthread_cond_wait(&me->can_eat, &waiter);
+
+  available_chopsticks[left_chop_num(me)] = 0;
+  available_chopsticks[right_chop_num(me)] = 0;
+
+  pthread_mutex_unlock(&waiter);
+  return 1;
+}
+
+void waiter_put_down(philosopher *me)
+{
+  pthread_mutex_lock(&waiter);
+
+  available_chopsticks[left_chop_num(me)] = 1;
+  available_chopsticks[right_chop_num(me)] = 1;
+
+  pthread_cond_signal(&left_phil(me)->can_eat);
+  pthread_cond_signal(&right_phil(me)->can_eat);
+
+  pthread_mutex_unlock(&waiter);
+}
+
+/*
+ * LOCK-FREE WAITER SOLUTION, shared with dp_waiter.c through
+ * dp_chopword.h. It never deadlocks, so it needs no check of Stop.
+ */
+int cas_pick_up(philosopher *me)
+{
+  chop_pair_take(left_chop_num(me), right_chop_num(me));
+  return 1;
+}
+
+void cas_put_down(philosopher *me)
+{
+  chop_pair_release(left_chop_num(me), right_chop_num(me));
+}
+
+strategy Strategies[] = {
+  { "naive",      naive_pick_up,      naive_put_down },
+  { "asymmetric", asymmetric_pick_up, naive_put_down },
+  { "waiter",     waiter_pick_up,     waiter_put_down },
+  { "cas",        cas_pick_up,        cas_put_down },
+};
+
+#define NUM_STRATEGIES (sizeof(Strategies) / sizeof(Strategies[0]))
+
+strategy *Current;
+
+/*
+ * Histogram bucket for a wait of ns nanoseconds
+ */
+int hist_bucket(uint64_t ns)
+{
+  int b;
+
+  for (b = 0; ns > 1 && b < HIST_BUCKETS - 1; b++)
+    ns >>= 1;
+  return b;
+}
+
+/*
+ * Account for one wait that ended at time now
+ */
+void record_wait(philosopher *me, uint64_t hungry, uint64_t now)
+{
+  uint64_t wait = now - hungry;
+
+  me->hist[hist_bucket(wait)]++;
+  me->wait_total += wait;
+  if (wait > me->wait_max)
+    me->wait_max = wait;
+
+  if (now - me->last_meal > me->starve_max)
+    me->starve_max = now - me->last_meal;
+  me->last_meal = now;
+}
+
+/*
+ * Philosopher code which makes each philosopher eat and think for a
+ * random period of time, timing how long each wait for chopsticks
+ * takes.
+ */
+static void *dp_thread(void *arg)
+{
+  int          eat_rnd;
+  int          i;
+  philosopher *me;
+  dp_rand      rng;
+  int          think_rnd;
+  uint64_t     hungry;
+
+  me = (philosopher *) arg;
+  dp_rand_seed(&rng, Seed, me->id);
+
+  while (!atomic_load_explicit(&Stop, memory_order_relaxed)) {
+    think_rnd = dp_rand_below(&rng, MAX_PHIL_THINK_PERIOD);
+    eat_rnd   = dp_rand_below(&rng, MAX_PHIL_EAT_PERIOD);
+
+    for (i = 0; i < think_rnd; i++){
+      think_one_thought();
+    }
+
+    hungry = now_ns();
+    if (!Current->pick_up(me))
+      break;
+    record_wait(me, hungry, now_ns());
+
+    for (i = 0; i < eat_rnd; i++){
+      eat_one_mouthful();
+    }
+
+    Current->put_down(me);
+    me->meals++;
+  }
+
+  return NULL;
+}
+
+/*
+ * Set up a fresh table for one run and seat the philosophers
+ */
+void set_table(uint64_t start)
+{
+  int i;
+
+  Diners               = calloc(Num_Phils, sizeof(philosopher));
+  chopstick            = calloc(Num_Chops, sizeof(pthread_mutex_t));
+  available_chopsticks = calloc(Num_Chops, sizeof(int));
+  if (!Diners || !chopstick || !available_chopsticks ||
+      chop_words_alloc(Num_Chops) < 0) {
+    fprintf(stderr, "Could not allocate a table for %d\n", Num_Phils);
+    exit(1);
+  }
+
+  pthread_mutex_init(&waiter, NULL);
+
+  for (i = 0; i < Num_Chops; i++) {
+    pthread_mutex_init(&chopstick[i], NULL);
+    available_chopsticks[i] = 1;
+  }
+
+  atomic_store(&Stop, 0);
+
+  for (i = 0; i < Num_Phils; i++) {
+    Diners[i].id = i;
+    Diners[i].last_meal = start;
+    pthread_cond_init(&Diners[i].can_eat, NULL);
+  }
+
+  for (i = 0; i < Num_Phils; i++) {
+    if (pthread_create(&Diners[i].thread, NULL, dp_thread, &Diners[i])) {
+      fprintf(stderr, "Could not create philosopher %d\n", i);
+      exit(1);
+    }
+  }
+}
+
+/*
+ * Undo set_table() once every philosopher has left
+ */
+void clear_table()
+{
+  int i;
+
+  for (i = 0; i < Num_Phils; i++)
+    pthread_cond_destroy(&Diners[i].can_eat);
+  for (i = 0; i < Num_Chops; i++)
+    pthread_mutex_destroy(&chopstick[i]);
+  pthread_mutex_destroy(&waiter);
+
+  free(Diners);
+  free(chopstick);
+  free(available_chopsticks);
+  chop_words_free();
+}
+
+long total_meals()
+{
+  long meals = 0;
+  int  i;
+
+  for (i = 0; i < Num_Phils; i++)
+    meals += Diners[i].meals;
+  return meals;
+}
+
+/*
+ * Smallest wait that the given fraction of waits in hist do not
+ * exceed, rounded up to a bucket boundary
+ */
+uint64_t hist_percentile(long *hist, double fraction)
+{
+  long total = 0, seen = 0;
+  int  b;
+
+  for (b = 0; b < HIST_BUCKETS; b++)
+    total += hist[b];
+
+  for (b = 0; b < HIST_BUCKETS; b++) {
+    seen += hist[b];
+    if (seen >= fraction * total)
+      break;
+  }
+  return (uint64_t) 2 << (b < HIST_BUCKETS ? b : HIST_BUCKETS - 1);
+}
+
+/*
+ * Print a duration in nanoseconds with a readable unit
+ */
+void print_time(const char *label, uint64_t ns)
+{
+  if (ns < 10000)
+    printf("%s%6lu ns", label, (unsigned long) ns);
+  else if (ns < 10000000)
+    printf("%s%6.1f us", label, ns / 1e3);
+  else
+    printf("%s%6.1f ms", label, ns / 1e6);
+}
+
+void print_histogram(long *hist)
+{
+  long most = 1;
+  int  b;
+
+  for (b = 0; b < HIST_BUCKETS; b++)
+    if (hist[b] > most)
+      most = hist[b];
+
+  for (b = 0; b < HIST_BUCKETS; b++) {
+    if (!hist[b])
+      continue;
+    print_time("  < ", (uint64_t) 2 << b);
+    printf(" %10ld %.*s\n", hist[b], (int) (40 * hist[b] / most),
+           "########################################");
+  }
+}
+
+/*
+ * Print what was measured in one run
+ */
+void report(strategy *s, double seconds, int deadlock, uint64_t end,
+            int verbose)
+{
+  long     hist[HIST_BUCKETS];
+  long     meals;
+  double   sum = 0, sum_sq = 0;
+  uint64_t wait_total = 0, wait_max = 0, starve_max = 0, starve;
+  int      i, b;
+
+  memset(hist, 0, sizeof(hist));
+
+  for (i = 0; i < Num_Phils; i++) {
+    philosopher *p = &Diners[i];
+
+    for (b = 0; b < HIST_BUCKETS; b++)
+      hist[b] += p->hist[b];
+
+    wait_total += p->wait_total;
+    if (p->wait_max > wait_max)
+      wait_max = p->wait_max;
+
+    /*
+     * The time since the last meal counts too, so a philosopher who
+     * never ate starved for the whole run. A meal may have started
+     * after end while the philosophers were being stopped.
+     */
+    starve = p->last_meal < end ? end - p->last_meal : 0;
+    if (starve > p->starve_max)
+      p->starve_max = starve;
+    if (p->starve_max > starve_max)
+      starve_max = p->starve_max;
+
+    sum    += p->meals;
+    sum_sq += (double) p->meals * p->meals;
+  }
+  meals = total_meals();
+
+  printf("== %s: %d philosophers, %.1f s%s\n", s->name, Num_Phils, seconds,
+         deadlock ? ", DEADLOCKED" : "");
+
+  /*
+   * Jain's index is 1 when every philosopher ate the same number of
+   * meals and 1/n when one philosopher ate them all
+   */
+  printf("meals %ld, %.1f meals/sec, fairness %.4f\n", meals, meals / seconds,
+         sum_sq > 0 ? sum * sum / (Num_Phils * sum_sq) : 0.0);
+
+  print_time("wait mean ", meals ? wait_total / meals : 0);
+  print_time(", p99 < ", hist_percentile(hist, 0.99));
+  print_time(", max ", wait_max);
+  print_time(", max starvation ", starve_max);
+  printf("\n");
+
+  print_histogram(hist);
+
+  if (Num_Phils <= MAX_PRINTED_PHILS || verbose) {
+    printf("  %5s %10s %10s %11s %10s %10s\n", "phil", "meals",
+           "mean wait", "p99 wait", "max wait", "starvation");
+    for (i = 0; i < Num_Phils; i++) {
+      philosopher *p = &Diners[i];
+
+      printf("  %5d %10ld", i, p->meals);
+      print_time(" ", p->meals ? p->wait_total / p->meals : 0);
+      print_time(" <", hist_percentile(p->hist, 0.99));
+      print_time(" ", p->wait_max);
+      print_time(" ", p->starve_max);
+      printf("\n");
+
+      if (verbose)
+        print_histogram(p->hist);
+    }
+  }
+  printf("\n");
+}
+
+/*
+ * Run one strategy for seconds seconds, counted from when the first
+ * philosopher sat down. A second without a single meal is taken as
+ * deadlock and ends the run early.
+ */
+void run(strategy *s, int seconds, int verbose)
+{
+  struct timespec nap;
+  uint64_t start, end, left;
+  long     before, after;
+  int      deadlock = 0;
+  int      i;
+
+  Current = s;
+  start = now_ns();
+  set_table(start);
+
+  after = 0;
+  while (!deadlock && (end = now_ns()) - start < seconds * 1000000000ull) {
+    left = seconds * 1000000000ull - (end - start);
+    if (left > 1000000000)
+      left = 1000000000;
+    nap.tv_sec  = left / 1000000000;
+    nap.tv_nsec = left % 1000000000;
+
+    before = after;
+    nanosleep(&nap, NULL);
+    after = total_meals();
+    if (after == before)
+      deadlock = 1;
+  }
+
+  end = now_ns();
+  atomic_store(&Stop, 1);
+
+  /*
+   * Philosophers waiting in the waiter solutions are woken as their
+   * neighbours put chopsticks down on the way out
+   */
+  for (i = 0; i < Num_Phils; i++)
+    pthread_join(Diners[i].thread, NULL);
+
+  report(s, (end - start) / 1e9, deadlock, end, verbose);
+  clear_table();
+}
+
+int main(int argc, char **argv)
+{
+  int seconds = RUN_SECONDS;
+  int verbose = 0;
+  int opt;
+  int i, j;
+
+  while ((opt = getopt(argc, argv, "n:d:v")) != -1) {
+    switch (opt) {
+    case 'n':
+      Num_Phils = Num_Chops = atoi(optarg);
+      break;
+    case 'd':
+      seconds = atoi(optarg);
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n philosophers] [-d seconds] [-v] "
+              "[strategy...]\n", argv[0]);
+      exit(1);
+    }
+  }
+
+  if (Num_Phils < 2 || seconds < 1) {
+    fprintf(stderr, "Need at least 2 philosophers and 1 second\n");
+    exit(1);
+  }
+
+  Seed = time(NULL);
+
+  /*
+   * Run the strategies named on the command line, or all of them
+   */
+  for (i = 0; i < NUM_STRATEGIES; i++) {
+    if (optind < argc) {
+      for (j = optind; j < argc; j++)
+        if (strcmp(argv[j], Strategies[i].name) == 0)
+          break;
+      if (j == argc)
+        continue;
+    }
+    run(&Strategies[i], seconds, verbose);
+  }
+
+  return 0;
+}
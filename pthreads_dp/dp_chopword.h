@@ -0,0 +1,160 @@
+#ifndef DP_CHOPWORD_H
+#define DP_CHOPWORD_H
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * The chopsticks of the LOCK-FREE WAITER SOLUTION, used by dp_waiter
+ * and dp_bench.
+ *
+ * Bit c % CHOPS_PER_WORD of chop_words[c / CHOPS_PER_WORD] is set
+ * while chopstick c is in use. The bits are packed into 32 bit words
+ * so a word can double as a futex, and word_waiters counts the
+ * philosophers sleeping on each word.
+ */
+#define CHOPS_PER_WORD               32
+
+static atomic_uint *chop_words;
+static atomic_int  *word_waiters;
+
+/*
+ * Allocate the words for num_chops chopsticks, all of them free.
+ * Returns -1 if they cannot be allocated.
+ */
+static inline int chop_words_alloc(int num_chops)
+{
+  int i;
+  int num_words;
+
+  num_words    = (num_chops + CHOPS_PER_WORD - 1) / CHOPS_PER_WORD;
+  chop_words   = calloc(num_words, sizeof(atomic_uint));
+  word_waiters = calloc(num_words, sizeof(atomic_int));
+  if (!chop_words || !word_waiters)
+    return -1;
+
+  for (i = 0; i < num_words; i++) {
+    atomic_init(&chop_words[i], 0);
+    atomic_init(&word_waiters[i], 0);
+  }
+  return 0;
+}
+
+static inline void chop_words_free(void)
+{
+  free(chop_words);
+  free(word_waiters);
+  chop_words = NULL;
+  word_waiters = NULL;
+}
+
+/*
+ * A philosopher who finds a chopstick taken sleeps on the futex of the
+ * word holding it until the word changes. It registers in
+ * word_waiters first, and releasing a chopstick clears its bit before
+ * checking word_waiters, so with both in sequentially consistent order
+ * either the sleeper sees the cleared bit or the releaser sees the
+ * sleeper.
+ */
+static inline void chop_word_wait(int w, unsigned int seen)
+{
+  atomic_fetch_add(&word_waiters[w], 1);
+
+  if (atomic_load(&chop_words[w]) == seen)
+    syscall(SYS_futex, &chop_words[w], FUTEX_WAIT_PRIVATE, seen,
+            NULL, NULL, 0);
+
+  atomic_fetch_sub(&word_waiters[w], 1);
+}
+
+static inline void chop_word_release(int w, unsigned int mask)
+{
+  atomic_fetch_and(&chop_words[w], ~mask);
+
+  if (atomic_load(&word_waiters[w]) > 0)
+    syscall(SYS_futex, &chop_words[w], FUTEX_WAKE_PRIVATE, INT_MAX,
+            NULL, NULL, 0);
+}
+
+/*
+ * Set the bits in mask of word w if none of them is set yet. Returns
+ * 0 and fills in seen with the word if some are taken.
+ */
+static inline int chop_word_try(int w, unsigned int mask,
+                                unsigned int *seen)
+{
+  unsigned int old;
+
+  old = atomic_load_explicit(&chop_words[w], memory_order_relaxed);
+  while (!(old & mask)) {
+    if (atomic_compare_exchange_weak_explicit(&chop_words[w], &old,
+                                              old | mask,
+                                              memory_order_acquire,
+                                              memory_order_relaxed))
+      return 1;
+  }
+
+  *seen = old;
+  return 0;
+}
+
+/*
+ * Take chopsticks left and right. Both are taken at once with a single
+ * compare and swap when their bits share a word, which is the case
+ * for every philosopher except those whose left chopstick starts a
+ * word. Those take the two words one at a time and give the first
+ * back if the second is taken, so nobody ever holds one chopstick
+ * while waiting for the other.
+ */
+static inline void chop_pair_take(int left, int right)
+{
+  int          lw, rw;
+  unsigned int lbit, rbit;
+  unsigned int seen;
+
+  lw   = left / CHOPS_PER_WORD;
+  rw   = right / CHOPS_PER_WORD;
+  lbit = 1u << (left % CHOPS_PER_WORD);
+  rbit = 1u << (right % CHOPS_PER_WORD);
+
+  if (lw == rw) {
+    while (!chop_word_try(lw, lbit | rbit, &seen))
+      chop_word_wait(lw, seen);
+    return;
+  }
+
+  while (1) {
+    while (!chop_word_try(lw, lbit, &seen))
+      chop_word_wait(lw, seen);
+
+    if (chop_word_try(rw, rbit, &seen))
+      return;
+
+    chop_word_release(lw, lbit);
+    chop_word_wait(rw, seen);
+  }
+}
+
+static inline void chop_pair_release(int left, int right)
+{
+  int          lw, rw;
+  unsigned int lbit, rbit;
+
+  lw   = left / CHOPS_PER_WORD;
+  rw   = right / CHOPS_PER_WORD;
+  lbit = 1u << (left % CHOPS_PER_WORD);
+  rbit = 1u << (right % CHOPS_PER_WORD);
+
+  if (lw == rw) {
+    chop_word_release(lw, lbit | rbit);
+  } else {
+    chop_word_release(lw, lbit);
+    chop_word_release(rw, rbit);
+  }
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef DP_RAND_H
+#define DP_RAND_H
+
+#include <stdint.h>
+
+/*
+ * A small PCG32 random number generator, one per philosopher.
+ *
+ * glibc's rand() keeps one hidden state behind a lock, so philosophers
+ * calling it every cycle all line up on that lock and the program ends
+ * up measuring the RNG instead of the chopsticks. Each philosopher
+ * keeps its own dp_rand on its stack instead, which needs no locking
+ * at all.
+ */
+typedef struct {
+  uint64_t state;
+  uint64_t inc;     /* Selects the stream, must be odd */
+} dp_rand;
+
+static inline uint32_t dp_rand_next(dp_rand *r)
+{
+  uint64_t old = r->state;
+  uint32_t xorshifted;
+  uint32_t rot;
+
+  r->state = old * 6364136223846793005ULL + r->inc;
+  xorshifted = ((old >> 18) ^ old) >> 27;
+  rot = old >> 59;
+  return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+/*
+ * Seed a generator. Giving every philosopher the same seed but its
+ * own id puts each one on a different stream, so no two of them
+ * think and eat in lockstep.
+ */
+static inline void dp_rand_seed(dp_rand *r, uint64_t seed, int id)
+{
+  r->state = 0;
+  r->inc = ((uint64_t) id << 1) | 1;
+  dp_rand_next(r);
+  r->state += seed;
+  dp_rand_next(r);
+}
+
+/*
+ * A number from 0 to bound - 1, used in place of rand() % bound
+ */
+static inline int dp_rand_below(dp_rand *r, int bound)
+{
+  return (int) (((uint64_t) dp_rand_next(r) * (uint32_t) bound) >> 32);
+}
+
+#endif
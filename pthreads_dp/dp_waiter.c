@@ -1,19 +1,24 @@
+#include <stdatomic.h>
 #include <stdio.h>
+#include <string.h>
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 #include <math.h>
 #include <stdlib.h>
 
+#include "dp_chopword.h"
+#include "dp_rand.h"
+
 /*
  * Some handy constants. Number of philosophers and chopsticks lets us
  * parameterize the number of concurrent threads and shared
- * resources. The maximum thinking and eating periods let us tune
- * relative periods of holding or not holding a resource. The MAX_BUF
- * and column_width constants help with creating output that makes
- * sense..
+ * resources, NUM_PHILS is the default and -n changes it. The maximum
+ * thinking and eating periods let us tune relative periods of holding
+ * or not holding a resource. The MAX_BUF and column_width constants
+ * help with creating output that makes sense..
  */
 #define NUM_PHILS                     5
-#define NUM_CHOPS             NUM_PHILS
 #define MAX_PHIL_THINK_PERIOD      1000
 #define MAX_PHIL_EAT_PERIOD         100
 #define MAX_BUF                     256
@@ -21,6 +26,13 @@
 #define COLUMN_WIDTH                 18
 #define ACCOUNTING_PERIOD             5
 #define ITERATION_LIMIT              10
+#define MAX_PRINTED_PHILS            20
+
+/*
+ * Ways to play the waiter
+ */
+#define WAITER_MUTEX                  0   /* one mutex guarding the table */
+#define WAITER_CAS                    1   /* compare and swap on the bitmask */
 
 /*
  * Structure defining a philosopher and any state we need to know
@@ -40,54 +52,68 @@ typedef struct {
 } philosopher;
 
 /* GLOBALS */
-philosopher Diners[NUM_PHILS];
-int         Stop = 0;
+philosopher *Diners;
+int          Num_Phils = NUM_PHILS;
+int          Num_Chops = NUM_PHILS;
+int          Waiter    = WAITER_MUTEX;
+int          Stop = 0;
+uint64_t     Seed;
 
 /* Each chopstick is shared between two philosophers */
-static pthread_mutex_t chopstick[NUM_CHOPS];
+static pthread_mutex_t *chopstick;
 
 /* WAITER SOLUTION uses these data structures */
 static pthread_mutex_t waiter;
-static int available_chopsticks[NUM_CHOPS];
+static int *available_chopsticks;
 
 /*
  * Helper functions for grabbing chopsticks, referencing neighbors.
  * Numbering assumptions:
- *   Philosophers: 1 -> NUM_PHILS
- *      - Left philosopher is (number + 1) modulo NUM_PHILS
- *      - Right philosopher is (number - 1) modulo NUM_PHILS
- *   Chopsticks:   1 -> NUM_CHOPS (generally equal to NUM_PHILS)
+ *   Philosophers: 1 -> Num_Phils
+ *      - Left philosopher is (number + 1) modulo Num_Phils
+ *      - Right philosopher is (number - 1) modulo Num_Phils
+ *   Chopsticks:   1 -> Num_Chops (generally equal to Num_Phils)
  *      - Left chopstick has same number as philosopher
- *      - Right chopstick is (philosopher number - 1) modulo NUM_CHOPS
+ *      - Right chopstick is (philosopher number - 1) modulo Num_Chops
  */
 philosopher *left_phil (philosopher *p)
 {
-  return &Diners[(p->id == (NUM_PHILS-1) ? 0 : (p->id)+1)];
+  return &Diners[(p->id == (Num_Phils-1) ? 0 : (p->id)+1)];
 }
 
 philosopher *right_phil (philosopher *p)
 {
-  return &Diners[(p->id == 0 ? (NUM_PHILS-1) : (p->id)-1)];
+  return &Diners[(p->id == 0 ? (Num_Phils-1) : (p->id)-1)];
+}
+
+int left_chop_num (philosopher *p)
+{
+  return p->id;
+}
+
+int right_chop_num (philosopher *p)
+{
+  return (p->id == 0 ? Num_Chops-1 : (p->id)-1);
 }
 
 pthread_mutex_t *left_chop (philosopher *p)
 {
-  return &chopstick[p->id];
+  return &chopstick[left_chop_num(p)];
 }
 
 pthread_mutex_t *right_chop (philosopher *p)
 {
-  return &chopstick[(p->id == 0 ? NUM_CHOPS-1 : (p->id)-1)];
+  return &chopstick[right_chop_num(p)];
 }
 
 int *left_chop_available (philosopher *p)
 {
-  return &available_chopsticks[p->id];
+  return &available_chopsticks[left_chop_num(p)];
 }
 
 int *right_chop_available (philosopher *p)
 {
-  return &available_chopsticks[(p->id == 0 ? NUM_CHOPS-1 : (p->id)-1)];
+  return &available_chopsticks[right_chop_num(p)];
 }
 
 /*
@@ -112,6 +138,64 @@ void eat_one_mouthful()
   i++;
 }
 
+/*
+ * WAITER SOLUTION: the waiter mutex guards the available flags of
+ * every chopstick, and a philosopher waits on its own condition
+ * variable until both of its chopsticks are free
+ */
+void waiter_pick_up(philosopher *me)
+{
+  // obtain waiter mutex
+  pthread_mutex_lock(&waiter);
+
+  // wait until both chopsticks are free
+  while(!(*left_chop_available(me) && *right_chop_available(me))){
+    pthread_cond_wait(&(me->can_eat), &waiter);
+  }
+
+  /*
+   * Grab both chopsticks: ASYMMETRIC and WAITER SOLUTION
+   */
+  *left_chop_available(me) = 0;
+  *right_chop_available(me) = 0;
+
+  // unlock waiter while eating
+  pthread_mutex_unlock(&waiter);
+}
+
+void waiter_put_down(philosopher *me)
+{
+  // reobtain waiter mutex
+  pthread_mutex_lock(&waiter);
+
+  /*
+   * Release both chopsticks: WAITER SOLUTION
+   */
+  *left_chop_available(me) = 1;
+  *right_chop_available(me) = 1;
+
+  // signal philosophers on either side
+  pthread_cond_signal(&(left_phil(me)->can_eat));
+  pthread_cond_signal(&(right_phil(me)->can_eat));
+
+  // let go of waiter
+  pthread_mutex_unlock(&waiter);
+}
+
+/*
+ * LOCK-FREE WAITER SOLUTION: both chopsticks are taken with one
+ * compare and swap on the bitmask where possible, see dp_chopword.h
+ */
+void cas_pick_up(philosopher *me)
+{
+  chop_pair_take(left_chop_num(me), right_chop_num(me));
+}
+
+void cas_put_down(philosopher *me)
+{
+  chop_pair_release(left_chop_num(me), right_chop_num(me));
+}
+
 /*
  * Philosopher code which makes each philosopher eat and think for a
  * random period of time.
@@ -120,12 +204,12 @@ static void *dp_thread(void *arg)
 {
   int          eat_rnd;
   int          i;
-  int          id;
   philosopher *me;
+  dp_rand      rng;
   int          think_rnd;
 
   me = (philosopher *) arg;
-  id = me->id;
+  dp_rand_seed(&rng, Seed, me->id);
 
   /*
    * While the gobal Stop flag is not set, keep thinking and eating
@@ -136,8 +220,8 @@ static void *dp_thread(void *arg)
      * Determine how long to think and eat in this cycle. Limit the
      * values to defined maximum values.
      */
-    think_rnd = (rand() % MAX_PHIL_THINK_PERIOD);
-    eat_rnd   = (rand() % MAX_PHIL_EAT_PERIOD);
+    think_rnd = dp_rand_below(&rng, MAX_PHIL_THINK_PERIOD);
+    eat_rnd   = dp_rand_below(&rng, MAX_PHIL_EAT_PERIOD);
 
     /*
      * Think a random number of thoughts before getting hungry. this
@@ -149,22 +233,13 @@ static void *dp_thread(void *arg)
       think_one_thought();
     }
 
-    // obtain waiter mutex
-    pthread_mutex_lock(&waiter);
-
-    // wait until both chopsticks are free
-    while(!(*left_chop_available(me) && *right_chop_available(me))){
-      pthread_cond_wait(&(me->can_eat), &waiter);
-    }
-
     /*
-     * Grab both chopsticks: ASYMMETRIC and WAITER SOLUTION
+     * Ask the waiter for both chopsticks
      */
-    *left_chop_available(me) = 0;
-    *right_chop_available(me) = 0;
-
-    // unlock waiter while eating
-    pthread_mutex_unlock(&waiter);
+    if (Waiter == WAITER_CAS)
+      cas_pick_up(me);
+    else
+      waiter_pick_up(me);
 
     /*
      * Eat some random amount of food. Again, this involves a
@@ -175,21 +250,13 @@ static void *dp_thread(void *arg)
       eat_one_mouthful();
     }
 
-    // reobtain waiter mutex
-    pthread_mutex_lock(&waiter);
-
     /*
-     * Release both chopsticks: WAITER SOLUTION
+     * And give them back
      */
-    *left_chop_available(me) = 1;
-    *right_chop_available(me) = 1;
-
-    // signal philosophers on either side
-    pthread_cond_signal(&(left_phil(me)->can_eat));
-    pthread_cond_signal(&(right_phil(me)->can_eat));
-
-    // let go of waiter
-    pthread_mutex_unlock(&waiter);
+    if (Waiter == WAITER_CAS)
+      cas_put_down(me);
+    else
+      waiter_put_down(me);
 
     /*
      * Update my progress in current session and for all time.
@@ -212,6 +279,19 @@ void set_table()
 {
   int i;
 
+  /*
+   * Allocate the philosophers and chopsticks for the table size
+   * chosen on the command line
+   */
+  Diners               = calloc(Num_Phils, sizeof(philosopher));
+  chopstick            = calloc(Num_Chops, sizeof(pthread_mutex_t));
+  available_chopsticks = calloc(Num_Chops, sizeof(int));
+  if (!Diners || !chopstick || !available_chopsticks ||
+      chop_words_alloc(Num_Chops) < 0) {
+    fprintf(stderr, "Could not allocate a table for %d\n", Num_Phils);
+    exit(1);
+  }
+
   /*
    * Initialize mutex used in the WAITER SOLUTION to represent the
    * waiter
@@ -220,9 +300,10 @@ void set_table()
 
   /*
    * Initialize all the Mutexes that represent the chopsticks. The
-   * available flags are used in the WAITER SOLUTION.
+   * available flags are used in the WAITER SOLUTION, and the bitmask
+   * of the LOCK-FREE WAITER SOLUTION starts out clear.
    */
-  for (i = 0; i < NUM_CHOPS; i++) {
+  for (i = 0; i < Num_Chops; i++) {
     pthread_mutex_init(&chopstick[i], NULL);
     available_chopsticks[i] = 1;
   }
@@ -231,10 +312,11 @@ void set_table()
    * Initialize the ID number, toal and session progress of each
    * philosopher.
    */
-  for (i = 0; i < NUM_PHILS; i++) {
+  for (i = 0; i < Num_Phils; i++) {
     Diners[i].prog = 0;
     Diners[i].prog_total = 0;
     Diners[i].id = i;
+    pthread_cond_init(&Diners[i].can_eat, NULL);
   }
 
   /*
@@ -243,32 +325,49 @@ void set_table()
    * and the pthread_t thread element of the structure is filled in by
    * the pthread_create() call.
    */
-  for (i = 0; i < NUM_PHILS; i++) {
-    pthread_create(&(Diners[i].thread), NULL, dp_thread, &Diners[i]);
+  for (i = 0; i < Num_Phils; i++) {
+    if (pthread_create(&(Diners[i].thread), NULL, dp_thread, &Diners[i])) {
+      fprintf(stderr, "Could not create philosopher %d\n", i);
+      exit(1);
+    }
   }
 }
 
 /*
- * Print the progress of all the philosphers.
+ * Print the progress of all the philosphers. Past MAX_PRINTED_PHILS
+ * philosophers only the totals are printed.
  */
 void print_progress()
 {
-  int i;
-  int j;
+  int  i;
+  int  j;
+  long meals;
 
   char buf[MAX_BUF];
 
+  meals = 0;
+  for (i = 0; i < Num_Phils; i++)
+    meals += Diners[i].prog;
+
+  printf("%ld meals, %.1f meals/sec\n", meals,
+         (double) meals / ACCOUNTING_PERIOD);
+
+  if (Num_Phils > MAX_PRINTED_PHILS) {
+    printf("\n");
+    return;
+  }
+
   /*
    * Print out the progress for the current accounting period and the
    * total for each philosopher thread.
    */
-  for (i = 0; i < NUM_PHILS;) {
+  for (i = 0; i < Num_Phils;) {
     /*
      * Print them in groups of 5 across a line, so use the inner loop
      * of j on 5
      */
     for (j = 0; j < 4; j++) {
-      if (i == NUM_PHILS) {
+      if (i == Num_Phils) {
         printf("\n");
         goto out;
       }
@@ -285,7 +384,7 @@ void print_progress()
       i++;
     }
 
-    if (i == NUM_PHILS) {
+    if (i == Num_Phils) {
       printf("\n");
       break;
     }
@@ -312,14 +411,47 @@ int main(int argc, char **argv)
   int i;
   int deadlock;
   int iter;
+  int opt;
 
   iter = 0;
 
   /*
-   * Randomly seed the random number generator used to control how
-   * long philosophers eat and think.
+   * -n sets the number of philosophers, and -w picks the mutex or
+   * the lock-free waiter
+   */
+  while ((opt = getopt(argc, argv, "n:w:")) != -1) {
+    switch (opt) {
+    case 'n':
+      Num_Phils = Num_Chops = atoi(optarg);
+      if (Num_Phils < 2) {
+        fprintf(stderr, "Need at least 2 philosophers\n");
+        exit(1);
+      }
+      break;
+
+    case 'w':
+      if (strcmp(optarg, "mutex") == 0)
+        Waiter = WAITER_MUTEX;
+      else if (strcmp(optarg, "cas") == 0)
+        Waiter = WAITER_CAS;
+      else {
+        fprintf(stderr, "Unknown waiter %s\n", optarg);
+        exit(1);
+      }
+      break;
+
+    default:
+      fprintf(stderr, "Usage: %s [-n philosophers] [-w mutex|cas]\n",
+              argv[0]);
+      exit(1);
+    }
+  }
+
+  /*
+   * Pick the seed the philosophers' random number generators start
+   * from. They control how long philosophers eat and think.
    */
-  srand(time(NULL));
+  Seed = time(NULL);
 
   /*
    * Set the table means create the chopsticks and the philosophers.
@@ -336,7 +468,7 @@ int main(int argc, char **argv)
      * philosopher is making progress, the philosopher will
      * increment it.
      */
-    for (i = 0; i < NUM_PHILS; i++)
+    for (i = 0; i < Num_Phils; i++)
       Diners[i].prog = 0;
 
     /*
@@ -353,7 +485,7 @@ int main(int argc, char **argv)
      * made progress in 5 seconds)
      */
     deadlock = 1;
-    for (i = 0; i < NUM_PHILS; i++)
+    for (i = 0; i < Num_Phils; i++)
       if (Diners[i].prog)
         deadlock = 0;
 
@@ -378,13 +510,13 @@ int main(int argc, char **argv)
    * Release all locks so philosophers can exit even if they are
    * deadlocked.
    */
-  for (i = 0; i < NUM_CHOPS; i++)
+  for (i = 0; i < Num_Chops; i++)
     pthread_mutex_unlock(&chopstick[i]);
 
   /*
    * Wait for philosophers to finish
    */
-  for (i = 0; i < NUM_PHILS; i++)
+  for (i = 0; i < Num_Phils; i++)
     pthread_join(Diners[i].thread, NULL);
 
   return 0;
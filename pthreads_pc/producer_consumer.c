@@ -1,12 +1,22 @@
+#include <limits.h>
+#include <linux/futex.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <time.h>
 
 /*
  * Define constants for how big the shared queue should be and how
- * much total work the produceers and consumers should perform
+ * much total work the produceers and consumers should perform. These
+ * and the constants below are only defaults, each can be changed on
+ * the command line.
  */
 #define QUEUESIZE 5
 #define WORK_MAX 30
@@ -23,35 +33,189 @@
 #define CONSUMER_CPU   25
 #define CONSUMER_BLOCK 10
 
+/*
+ * Default number of items the batch queue type moves per critical
+ * section
+ */
+#define BATCH_SIZE 16
+
+/*
+ * Ways the shared queue can park producers and consumers that have to
+ * wait
+ */
+#define PARK_COND  0   /* pthread condition variables */
+#define PARK_FUTEX 1   /* a futex word per condition */
+
+/*
+ * Size of a cache line. Data written by different threads is laid out
+ * at least this far apart so that one thread's writes do not keep
+ * invalidating the line another thread is working on.
+ */
+#define CACHE_LINE 64
+
 /*****************************************************
- *   Shared Queue Related Structures and Routines    *
+ *   Configuration and Statistics                    *
  *****************************************************/
+/*
+ * Settings for this run, filled in from the defaults above and the
+ * command line
+ */
 typedef struct {
-  int buf[QUEUESIZE];   /* Array for Queue contents, managed as circular queue */
-  int head;             /* Index of the queue head */
-  int tail;             /* Index of the queue tail, the next empty slot */
+  int queue_size;      /* Capacity of the shared queue */
+  int work_max;        /* Total items to produce and consume */
+  int producer_cpu;    /* CPU bound work per item produced */
+  int producer_block;  /* Milliseconds blocked per item produced */
+  int consumer_cpu;    /* CPU bound work per item consumed */
+  int consumer_block;  /* Milliseconds blocked per item consumed */
+  int batch;           /* Items per critical section, 0 to drain all */
+  int park;            /* PARK_COND or PARK_FUTEX */
+  int quiet;           /* Suppress the per-item announcements */
+} pcconfig;
+
+pcconfig config = {
+  QUEUESIZE,
+  WORK_MAX,
+  PRODUCER_CPU,
+  PRODUCER_BLOCK,
+  CONSUMER_CPU,
+  CONSUMER_BLOCK,
+  BATCH_SIZE,
+  PARK_COND,
+  0
+};
 
-  int full;             /* Flag set when queue is full  */
-  int empty;            /* Flag set when queue is empty */
+/*
+ * Print an announcement unless quiet mode was requested
+ */
+#define announce(...)                           \
+  do {                                          \
+    if (!config.quiet)                          \
+      printf (__VA_ARGS__);                     \
+  } while (0)
+
+/*
+ * Counters each producer and consumer keeps about its own work and
+ * the time it lost to synchronization. Only the owning thread writes
+ * them, main reads them after the thread is joined.
+ */
+typedef struct {
+  long   items;      /* Items produced or consumed by this thread */
+  long   waits;      /* Times this thread parked waiting on the queue */
+  double wait_time;  /* Seconds spent parked */
+  long   contended;  /* Times this thread found the mutex already held */
+  double lock_time;  /* Seconds spent acquiring a mutex held by another */
+} pcstats;
+
+/*
+ * Allocate zeroed memory starting on a cache line boundary, so the
+ * CACHE_LINE aligned members of a structure really get lines of their
+ * own
+ */
+void *cacheAlloc (size_t size)
+{
+  void *p;
+
+  size = (size + CACHE_LINE - 1) & ~((size_t) CACHE_LINE - 1);
+
+  p = aligned_alloc (CACHE_LINE, size);
+  if (p != NULL)
+    memset (p, 0, size);
+
+  return (p);
+}
+
+/*
+ * Current time in seconds from an arbitrary starting point
+ */
+double timeNow (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Lock a mutex, accounting for the time spent if it was held by
+ * another thread. The uncontended case costs a single trylock.
+ */
+void statLock (pthread_mutex_t *mutex, pcstats *stats)
+{
+  double start;
+
+  if (pthread_mutex_trylock (mutex) == 0)
+    return;
+
+  start = timeNow ();
+  pthread_mutex_lock (mutex);
+
+  stats->contended++;
+  stats->lock_time += timeNow () - start;
+}
+
+/*
+ * Wait on a condition variable, accounting for the time spent
+ * blocked
+ */
+void statWait (pthread_cond_t *cond, pthread_mutex_t *mutex, pcstats *stats)
+{
+  double start;
+
+  start = timeNow ();
+  pthread_cond_wait (cond, mutex);
+
+  stats->waits++;
+  stats->wait_time += timeNow () - start;
+}
+
+/*****************************************************
+ *   Shared Queue Related Structures and Routines    *
+ *****************************************************/
+/*
+ * Every field is changed under the one mutex, and both sides write
+ * both flags, so splitting the fields across cache lines would not
+ * keep producers and consumers apart. The queue is left unpadded.
+ */
+typedef struct {
+  int *buf;             /* Array for Queue contents, managed as circular queue */
+  int size;             /* Number of elements in buf */
 
   pthread_mutex_t *mutex;     /* Mutex protecting this Queue's data */
   pthread_cond_t  *notFull;   /* Used by producers to await room to produce*/
   pthread_cond_t  *notEmpty;  /* Used by consumers to await something to consume*/
+
+  int head;             /* Index of the queue head */
+  int empty;            /* Flag set when queue is empty */
+  int emptyWaiters;           /* Consumers parked on notEmpty */
+  atomic_uint notEmptySeq;    /* Futex word standing in for notEmpty */
+
+  int tail;             /* Index of the queue tail, the next empty slot */
+  int full;             /* Flag set when queue is full  */
+  int fullWaiters;            /* Producers parked on notFull */
+  atomic_uint notFullSeq;     /* Futex word standing in for notFull */
 } queue;
 
 /*
- * Create the queue shared among all producers and consumers
+ * Create the queue shared among all producers and consumers, holding
+ * at most size items
  */
-queue *queueInit (void)
+queue *queueInit (int size)
 {
   queue *q;
 
   /*
    * Allocate the structure that holds all queue information
    */
-  q = (queue *)malloc (sizeof (queue));
+  q = (queue *)cacheAlloc (sizeof (queue));
   if (q == NULL) return (NULL);
 
+  q->buf = (int *)malloc (sizeof (int) * size);
+  if (q->buf == NULL) {
+    free (q);
+    return (NULL);
+  }
+  q->size = size;
+
   /*
    * Initialize the state variables. See the definition of the Queue
    * structure for the definition of each.
@@ -62,6 +226,12 @@ queue *queueInit (void)
   q->head  = 0;
   q->tail  = 0;
 
+  q->fullWaiters  = 0;
+  q->emptyWaiters = 0;
+
+  atomic_init (&q->notFullSeq, 0);
+  atomic_init (&q->notEmptySeq, 0);
+
   /*
    * Allocate and initialize the queue mutex
    */
@@ -102,8 +272,9 @@ void queueDelete (queue *q)
   free (q->notEmpty);
 
   /*
-   * Deallocate the queue structure
+   * Deallocate the queue contents and structure
    */
+  free (q->buf);
   free (q);
 }
 
@@ -121,7 +292,7 @@ void queueAdd (queue *q, int in)
    * the array. This implements the circularity of the queue inthe
    * array.
    */
-  if (q->tail == QUEUESIZE)
+  if (q->tail == q->size)
     q->tail = 0;
 
   /*
@@ -140,35 +311,690 @@ void queueAdd (queue *q, int in)
   return;
 }
 
-void queueRemove (queue *q, int *out)
+void queueRemove (queue *q, int *out)
+{
+  /*
+   * Copy the element at head into the output variable and increment
+   * the head pointer to move to the next element.
+   */
+  *out = q->buf[q->head];
+  q->head++;
+
+  /*
+   * Wrap the index around to zero if it reached the size of the
+   * array. This implements the circualrity of the queue int he array.
+   */
+  if (q->head == q->size)
+    q->head = 0;
+
+  /*
+   * If head catches up to tail as we delete an item, then the queue
+   * is empty.
+   */
+  if (q->head == q->tail)
+    q->empty = 1;
+
+  /*
+   * since we took an item out, the queue is certainly not full
+   */
+  q->full = 0;
+
+  return;
+}
+
+/*
+ * Number of items currently in the queue
+ */
+int queueCount (queue *q)
+{
+  if (q->full)
+    return (q->size);
+
+  return ((q->tail - q->head + q->size) % q->size);
+}
+
+/*
+ * Add up to n items from the in array, stopping early if the queue
+ * fills. Returns the number of items added. The free slots form at
+ * most two runs, one up to the end of the array and one wrapping to
+ * its start, so the items are copied in at most two pieces.
+ */
+int queueAddN (queue *q, const int *in, int n)
+{
+  int room;
+  int run;
+
+  room = q->size - queueCount (q);
+  if (n > room)
+    n = room;
+  if (n == 0)
+    return (0);
+
+  run = q->size - q->tail;
+  if (run > n)
+    run = n;
+
+  memcpy (&q->buf[q->tail], in, sizeof (int) * run);
+  memcpy (q->buf, in + run, sizeof (int) * (n - run));
+
+  q->tail = (q->tail + n) % q->size;
+
+  /*
+   * Update the flags exactly as queueAdd does after its last item
+   */
+  if (q->tail == q->head)
+    q->full = 1;
+  q->empty = 0;
+
+  return (n);
+}
+
+/*
+ * Remove up to n items into the out array, stopping early if the
+ * queue empties. Returns the number of items removed.
+ */
+int queueRemoveN (queue *q, int *out, int n)
+{
+  int count;
+  int run;
+
+  count = queueCount (q);
+  if (n > count)
+    n = count;
+  if (n == 0)
+    return (0);
+
+  run = q->size - q->head;
+  if (run > n)
+    run = n;
+
+  memcpy (out, &q->buf[q->head], sizeof (int) * run);
+  memcpy (out + run, q->buf, sizeof (int) * (n - run));
+
+  q->head = (q->head + n) % q->size;
+
+  if (q->head == q->tail)
+    q->empty = 1;
+  q->full = 0;
+
+  return (n);
+}
+
+/*
+ * Remove everything in the queue into the out array, which must have
+ * room for q->size items. Returns the number of items removed.
+ */
+int queueDrain (queue *q, int *out)
+{
+  return (queueRemoveN (q, out, q->size));
+}
+
+/*
+ * Park the calling thread until it is woken through cond or seq. The
+ * queue mutex must be held and is held again on return. While parked
+ * the thread is counted in waiters so wakers can skip the wakeup when
+ * nobody is waiting.
+ *
+ * In futex mode the thread sleeps on the sequence word instead of the
+ * condition variable. The word is read under the mutex and every
+ * wakeup bumps it under the mutex, so a wakeup that lands between
+ * unlocking and sleeping makes FUTEX_WAIT return at once instead of
+ * being lost.
+ */
+void queuePark (queue *q, pthread_cond_t *cond, atomic_uint *seq,
+                int *waiters, pcstats *stats)
+{
+  unsigned int current;
+  double       start;
+
+  (*waiters)++;
+
+  if (config.park == PARK_COND) {
+    statWait (cond, q->mutex, stats);
+  } else {
+    current = atomic_load_explicit (seq, memory_order_relaxed);
+    start   = timeNow ();
+
+    pthread_mutex_unlock (q->mutex);
+    syscall (SYS_futex, seq, FUTEX_WAIT_PRIVATE, current, NULL, NULL, 0);
+    pthread_mutex_lock (q->mutex);
+
+    stats->waits++;
+    stats->wait_time += timeNow () - start;
+  }
+
+  (*waiters)--;
+}
+
+/*
+ * Wake one thread parked on cond or seq, or all of them. The queue
+ * mutex must be held.
+ */
+void queueUnpark (pthread_cond_t *cond, atomic_uint *seq, int all)
+{
+  if (config.park == PARK_COND) {
+    if (all)
+      pthread_cond_broadcast (cond);
+    else
+      pthread_cond_signal (cond);
+  } else {
+    atomic_fetch_add_explicit (seq, 1, memory_order_relaxed);
+    syscall (SYS_futex, seq, FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1,
+             NULL, NULL, 0);
+  }
+}
+
+/*
+ * Wake whoever needs waking after items were added. A consumer only
+ * parks on an empty queue, so only the add that makes the queue
+ * non-empty signals one. A consumer that then leaves items behind
+ * passes the wakeup on in queueRemoved(), which covers the items
+ * added in the meantime without a signal per item. Producers waiting
+ * for room are handed the same kind of turn while room remains.
+ */
+void queueAdded (queue *q, int wasEmpty)
+{
+  if (wasEmpty && q->emptyWaiters > 0)
+    queueUnpark (q->notEmpty, &q->notEmptySeq, 0);
+
+  if (!q->full && q->fullWaiters > 0)
+    queueUnpark (q->notFull, &q->notFullSeq, 0);
+}
+
+/*
+ * The mirror of queueAdded() for items removed
+ */
+void queueRemoved (queue *q, int wasFull)
+{
+  if (wasFull && q->fullWaiters > 0)
+    queueUnpark (q->notFull, &q->notFullSeq, 0);
+
+  if (!q->empty && q->emptyWaiters > 0)
+    queueUnpark (q->notEmpty, &q->notEmptySeq, 0);
+}
+
+/*****************************************************
+ *   Lock-free Ring Related Structures and Routines   *
+ *****************************************************/
+/*
+ * A bounded multi-producer/multi-consumer ring that needs no lock on
+ * its fast path. Every slot carries a sequence number telling
+ * whether it is ready to be written or read at a given position:
+ *
+ *   seq == pos       the slot is empty and may be filled at pos
+ *   seq == pos + 1   the slot holds the item added at pos
+ *
+ * Producers claim a position by advancing tail with a compare and
+ * swap and consumers do the same with head. The capacity is a power
+ * of two so a position maps to its slot with a mask.
+ *
+ * Threads only block when the ring is truly full or empty. They then
+ * park on a condition variable after registering themselves in a
+ * waiter count, and the other side only takes the lock to wake them
+ * when that count is non-zero.
+ */
+typedef struct {
+  atomic_size_t seq;    /* Sequence number, see above */
+  int           value;  /* Item stored in this slot */
+} ringSlot;
+
+typedef struct {
+  ringSlot     *slots;  /* Array of capacity slots */
+  size_t        mask;   /* capacity - 1 */
+
+  /*
+   * head and tail are each on a line of their own. The waiter counts,
+   * read on every add and remove but written only when parking, sit
+   * on a third.
+   */
+  _Alignas(CACHE_LINE)
+  atomic_size_t head;   /* Next position to remove from */
+
+  _Alignas(CACHE_LINE)
+  atomic_size_t tail;   /* Next position to add at */
+
+  _Alignas(CACHE_LINE)
+  atomic_int    fullWaiters;   /* Producers parked on notFull */
+  atomic_int    emptyWaiters;  /* Consumers parked on notEmpty */
+
+  pthread_mutex_t *mutex;     /* Only used to park and wake threads */
+  pthread_cond_t  *notFull;   /* Used by producers to await a free slot */
+  pthread_cond_t  *notEmpty;  /* Used by consumers to await an item */
+} ring;
+
+/*
+ * Create a ring holding at least size items. The capacity is rounded
+ * up to a power of two.
+ */
+ring *ringInit (int size)
+{
+  ring   *r;
+  size_t  cap;
+  size_t  i;
+
+  r = (ring *)cacheAlloc (sizeof (ring));
+  if (r == NULL) return (NULL);
+
+  for (cap = 2; cap < (size_t) size; cap <<= 1)
+    ;
+
+  r->slots = (ringSlot *)malloc (sizeof (ringSlot) * cap);
+  if (r->slots == NULL) {
+    free (r);
+    return (NULL);
+  }
+
+  /*
+   * Every slot starts out empty and ready to be filled at its own
+   * index
+   */
+  for (i = 0; i < cap; i++)
+    atomic_init (&r->slots[i].seq, i);
+
+  r->mask = cap - 1;
+
+  atomic_init (&r->head, 0);
+  atomic_init (&r->tail, 0);
+  atomic_init (&r->fullWaiters, 0);
+  atomic_init (&r->emptyWaiters, 0);
+
+  r->mutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
+  pthread_mutex_init (r->mutex, NULL);
+
+  r->notFull = (pthread_cond_t *) malloc (sizeof (pthread_cond_t));
+  pthread_cond_init (r->notFull, NULL);
+
+  r->notEmpty = (pthread_cond_t *) malloc (sizeof (pthread_cond_t));
+  pthread_cond_init (r->notEmpty, NULL);
+
+  return (r);
+}
+
+/*
+ * Delete the ring, deallocating dynamically allocated memory
+ */
+void ringDelete (ring *r)
+{
+  pthread_mutex_destroy (r->mutex);
+  free (r->mutex);
+
+  pthread_cond_destroy (r->notFull);
+  free (r->notFull);
+
+  pthread_cond_destroy (r->notEmpty);
+  free (r->notEmpty);
+
+  free (r->slots);
+  free (r);
+}
+
+/*
+ * Try to add an item without blocking. Returns 1 on success and 0 if
+ * the ring is full.
+ */
+int ringTryAdd (ring *r, int in)
+{
+  ringSlot *slot;
+  size_t    pos;
+  size_t    seq;
+  intptr_t  diff;
+
+  pos = atomic_load_explicit (&r->tail, memory_order_relaxed);
+
+  while (1) {
+    slot = &r->slots[pos & r->mask];
+    seq  = atomic_load_explicit (&slot->seq, memory_order_acquire);
+    diff = (intptr_t) seq - (intptr_t) pos;
+
+    if (diff == 0) {
+      /*
+       * The slot is free at this position. Claim it, unless another
+       * producer beat us to it, in which case pos is reloaded.
+       */
+      if (atomic_compare_exchange_weak_explicit (&r->tail, &pos, pos + 1,
+                                                 memory_order_relaxed,
+                                                 memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      /*
+       * The slot still holds the item from one lap ago: full
+       */
+      return (0);
+    } else {
+      pos = atomic_load_explicit (&r->tail, memory_order_relaxed);
+    }
+  }
+
+  /*
+   * Publish the item to consumers
+   */
+  slot->value = in;
+  atomic_store_explicit (&slot->seq, pos + 1, memory_order_release);
+
+  return (1);
+}
+
+/*
+ * Try to remove an item without blocking. Returns 1 on success and 0
+ * if the ring is empty.
+ */
+int ringTryRemove (ring *r, int *out)
+{
+  ringSlot *slot;
+  size_t    pos;
+  size_t    seq;
+  intptr_t  diff;
+
+  pos = atomic_load_explicit (&r->head, memory_order_relaxed);
+
+  while (1) {
+    slot = &r->slots[pos & r->mask];
+    seq  = atomic_load_explicit (&slot->seq, memory_order_acquire);
+    diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit (&r->head, &pos, pos + 1,
+                                                 memory_order_relaxed,
+                                                 memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      /*
+       * Nothing has been added at this position yet: empty
+       */
+      return (0);
+    } else {
+      pos = atomic_load_explicit (&r->head, memory_order_relaxed);
+    }
+  }
+
+  /*
+   * Take the item and hand the slot back to producers for the next
+   * lap around the ring
+   */
+  *out = slot->value;
+  atomic_store_explicit (&slot->seq, pos + r->mask + 1, memory_order_release);
+
+  return (1);
+}
+
+/*
+ * Wake one thread parked on cond if the waiter count says there is
+ * one. The fence orders the caller's update of the ring before the
+ * read of the count. It pairs with the increment in ringPark() so
+ * that either the parking thread sees the update on its final retry
+ * or we see it waiting.
+ */
+void ringWake (ring *r, atomic_int *waiters, pthread_cond_t *cond)
+{
+  atomic_thread_fence (memory_order_seq_cst);
+
+  if (atomic_load_explicit (waiters, memory_order_relaxed) > 0) {
+    pthread_mutex_lock (r->mutex);
+    pthread_cond_signal (cond);
+    pthread_mutex_unlock (r->mutex);
+  }
+}
+
+/*
+ * Add an item, parking while the ring is full
+ */
+void ringAdd (ring *r, int in, pcstats *stats)
+{
+  if (ringTryAdd (r, in)) {
+    ringWake (r, &r->emptyWaiters, r->notEmpty);
+    return;
+  }
+
+  statLock (r->mutex, stats);
+  atomic_fetch_add (&r->fullWaiters, 1);
+
+  /*
+   * Retry after registering as a waiter so a slot freed in between
+   * is not missed
+   */
+  while (!ringTryAdd (r, in))
+    statWait (r->notFull, r->mutex, stats);
+
+  atomic_fetch_sub (&r->fullWaiters, 1);
+  pthread_mutex_unlock (r->mutex);
+
+  ringWake (r, &r->emptyWaiters, r->notEmpty);
+}
+
+/*
+ * Remove an item, parking while the ring is empty
+ */
+void ringRemove (ring *r, int *out, pcstats *stats)
+{
+  if (ringTryRemove (r, out)) {
+    ringWake (r, &r->fullWaiters, r->notFull);
+    return;
+  }
+
+  statLock (r->mutex, stats);
+  atomic_fetch_add (&r->emptyWaiters, 1);
+
+  while (!ringTryRemove (r, out))
+    statWait (r->notEmpty, r->mutex, stats);
+
+  atomic_fetch_sub (&r->emptyWaiters, 1);
+  pthread_mutex_unlock (r->mutex);
+
+  ringWake (r, &r->fullWaiters, r->notFull);
+}
+
+/*****************************************************
+ *   SPSC Lane Related Structures and Routines       *
+ *****************************************************/
+/*
+ * Instead of one queue shared by everybody, every producer owns one
+ * single-producer/single-consumer ring, a lane, to each consumer. A
+ * lane has exactly one writer of tail and, normally, one writer of
+ * head, so adding and removing are plain loads and stores with
+ * acquire/release ordering and never wait on another thread.
+ *
+ * A consumer whose lanes are all empty may steal from the lanes of
+ * other consumers. Thieves serialize among themselves with the lane's
+ * stealLock, and exclude the owning consumer with a Dekker style
+ * handshake on ownerBusy and thiefBusy: each side raises its flag,
+ * issues a full fence, and backs off if it sees the other's flag. The
+ * owner does this once per visit to a lane and then takes a whole
+ * batch, so its fast path still needs no read-modify-write.
+ */
+typedef struct {
+  int          *buf;        /* Array of capacity items */
+  size_t        mask;       /* capacity - 1 */
+
+  /*
+   * The consumer side, the producer side and the thieves each write
+   * their own cache line
+   */
+  _Alignas(CACHE_LINE)
+  atomic_size_t head;       /* Next position to remove from */
+  atomic_int    ownerBusy;  /* Raised while the owning consumer takes items */
+
+  _Alignas(CACHE_LINE)
+  atomic_size_t tail;       /* Next position to add at, only the producer writes it */
+
+  _Alignas(CACHE_LINE)
+  atomic_int    thiefBusy;  /* Raised while a thief takes an item */
+  pthread_mutex_t stealLock;  /* Held by the one thief allowed at a time */
+} lane;
+
+typedef struct {
+  lane       *lanes;          /* pros * cons lanes, lanes[p * cons + c] */
+  int         pros;           /* Number of producers */
+  int         cons;           /* Number of consumers */
+  atomic_int  producersDone;  /* Producers that have added all their items */
+} laneSet;
+
+/*
+ * Delete the lanes, deallocating dynamically allocated memory
+ */
+void laneSetDelete (laneSet *ls)
+{
+  int i;
+
+  for (i = 0; i < ls->pros * ls->cons; i++) {
+    pthread_mutex_destroy (&ls->lanes[i].stealLock);
+    free (ls->lanes[i].buf);
+  }
+
+  free (ls->lanes);
+  free (ls);
+}
+
+/*
+ * Create the lanes between pros producers and cons consumers, each
+ * holding at least size items
+ */
+laneSet *laneSetInit (int size, int pros, int cons)
+{
+  laneSet *ls;
+  lane    *l;
+  size_t   cap;
+  int      i;
+
+  ls = (laneSet *)malloc (sizeof (laneSet));
+  if (ls == NULL) return (NULL);
+
+  ls->lanes = (lane *)cacheAlloc (sizeof (lane) * pros * cons);
+  if (ls->lanes == NULL) {
+    free (ls);
+    return (NULL);
+  }
+
+  ls->pros = pros;
+  ls->cons = cons;
+  atomic_init (&ls->producersDone, 0);
+
+  for (cap = 2; cap < (size_t) size; cap <<= 1)
+    ;
+
+  for (i = 0; i < pros * cons; i++) {
+    l = &ls->lanes[i];
+
+    l->buf = (int *)malloc (sizeof (int) * cap);
+    if (l->buf == NULL) {
+      laneSetDelete (ls);
+      return (NULL);
+    }
+    l->mask = cap - 1;
+
+    atomic_init (&l->head, 0);
+    atomic_init (&l->tail, 0);
+    atomic_init (&l->ownerBusy, 0);
+    atomic_init (&l->thiefBusy, 0);
+    pthread_mutex_init (&l->stealLock, NULL);
+  }
+
+  return (ls);
+}
+
+/*
+ * Add an item to a lane. Only the producer owning the lane may call
+ * this. Returns 0 without waiting if the lane is full.
+ */
+int laneAdd (lane *l, int in)
+{
+  size_t tail;
+
+  tail = atomic_load_explicit (&l->tail, memory_order_relaxed);
+  if (tail - atomic_load_explicit (&l->head, memory_order_acquire) > l->mask)
+    return (0);
+
+  l->buf[tail & l->mask] = in;
+  atomic_store_explicit (&l->tail, tail + 1, memory_order_release);
+
+  return (1);
+}
+
+/*
+ * Remove up to max items from a lane on behalf of its owning consumer.
+ * Returns the number removed, which is zero if the lane is empty or a
+ * thief is working on it.
+ */
+int laneTake (lane *l, int *out, int max)
+{
+  size_t head;
+  size_t tail;
+  int    n;
+
+  atomic_store_explicit (&l->ownerBusy, 1, memory_order_relaxed);
+  atomic_thread_fence (memory_order_seq_cst);
+
+  if (atomic_load_explicit (&l->thiefBusy, memory_order_acquire)) {
+    atomic_store_explicit (&l->ownerBusy, 0, memory_order_relaxed);
+    return (0);
+  }
+
+  head = atomic_load_explicit (&l->head, memory_order_relaxed);
+  tail = atomic_load_explicit (&l->tail, memory_order_acquire);
+
+  for (n = 0; n < max && head != tail; n++, head++)
+    out[n] = l->buf[head & l->mask];
+
+  atomic_store_explicit (&l->head, head, memory_order_release);
+  atomic_store_explicit (&l->ownerBusy, 0, memory_order_release);
+
+  return (n);
+}
+
+/*
+ * Remove one item from a lane owned by another consumer. Returns 0 if
+ * the lane is empty or busy.
+ */
+int laneSteal (lane *l, int *out)
+{
+  size_t head;
+  int    stolen;
+
+  if (pthread_mutex_trylock (&l->stealLock) != 0)
+    return (0);
+
+  atomic_store_explicit (&l->thiefBusy, 1, memory_order_relaxed);
+  atomic_thread_fence (memory_order_seq_cst);
+
+  stolen = 0;
+  if (!atomic_load_explicit (&l->ownerBusy, memory_order_acquire)) {
+    head = atomic_load_explicit (&l->head, memory_order_relaxed);
+
+    if (head != atomic_load_explicit (&l->tail, memory_order_acquire)) {
+      *out = l->buf[head & l->mask];
+      atomic_store_explicit (&l->head, head + 1, memory_order_release);
+      stolen = 1;
+    }
+  }
+
+  atomic_store_explicit (&l->thiefBusy, 0, memory_order_release);
+  pthread_mutex_unlock (&l->stealLock);
+
+  return (stolen);
+}
+
+/*
+ * True when nothing is left in the lane. Only meaningful once the
+ * producer owning it has finished.
+ */
+int laneEmpty (lane *l)
+{
+  return (atomic_load_explicit (&l->head, memory_order_acquire) ==
+          atomic_load_explicit (&l->tail, memory_order_acquire));
+}
+
+/*
+ * Give up the processor while there is nothing to do, accounting for
+ * it as a wait
+ */
+void laneYield (pcstats *stats)
 {
-  /*
-   * Copy the element at head into the output variable and increment
-   * the head pointer to move to the next element.
-   */
-  *out = q->buf[q->head];
-  q->head++;
-
-  /*
-   * Wrap the index around to zero if it reached the size of the
-   * array. This implements the circualrity of the queue int he array.
-   */
-  if (q->head == QUEUESIZE)
-    q->head = 0;
+  double start;
 
-  /*
-   * If head catches up to tail as we delete an item, then the queue
-   * is empty.
-   */
-  if (q->head == q->tail)
-    q->empty = 1;
-
-  /*
-   * since we took an item out, the queue is certainly not full
-   */
-  q->full = 0;
+  start = timeNow ();
+  sched_yield ();
 
-  return;
+  stats->waits++;
+  stats->wait_time += timeNow () - start;
 }
 
 /******************************************************
@@ -178,19 +1004,30 @@ void queueRemove (queue *q, int *out)
  * Argument struct used to pass consumers and producers thier
  * arguments.
  *
- * q     - arg provides a pointer to the shared queue.
+ * q     - arg provides a pointer to the shared queue, or ring when the
+ *         lock-free queue type is selected.
  *
  * count - arg is a pointer to a counter for this thread to track how
- *         much work it did.
+ *         much work it did. It is atomic so the lock-free producers and
+ *         consumers can claim items from it without a lock.
  *
  * tid   - arg provides the ID number of the producer or consumer,
  *         whichis also its index into the array of thread structures.
  *
+ * stats - counters the thread keeps about its own work, reported by
+ *         main once the thread exits.
+ *
+ * The structures are kept in arrays, one per thread, and each thread
+ * updates its stats constantly. Aligning the structure to a cache
+ * line keeps neighbouring threads' updates off each other's lines.
+ *
  */
 typedef struct {
-  queue *q;
-  int   *count;
-  int    tid;
+  _Alignas(CACHE_LINE)
+  void       *q;
+  atomic_int *count;
+  int         tid;
+  pcstats     stats;
 } pcdata;
 
 int memory_access_area[100000];
@@ -260,15 +1097,16 @@ void do_work(int cpu_iterations, int blocking_time)
 
 void *producer (void *parg)
 {
-  queue  *fifo;
-  int     item_produced;
-  pcdata *mydata;
-  int     my_tid;
-  int    *total_produced;
+  queue      *fifo;
+  int         item_produced;
+  int         was_empty;
+  pcdata     *mydata;
+  int         my_tid;
+  atomic_int *total_produced;
 
   mydata = (pcdata *) parg;
 
-  fifo           = mydata->q;
+  fifo           = (queue *) mydata->q;
   total_produced = mydata->count;
   my_tid         = mydata->tid;
 
@@ -282,26 +1120,27 @@ void *producer (void *parg)
      * it. Finally, at the end of the loop, outside the critical
      * section, announce that we produced it.
      */
-    do_work(PRODUCER_CPU, PRODUCER_BLOCK);
+    do_work(config.producer_cpu, config.producer_block);
 
     // lock queue mutex so noone else can mess with it
-    pthread_mutex_lock(fifo->mutex);
+    statLock(fifo->mutex, &mydata->stats);
 
     /*
      * If the queue is full, we have no place to put anything we
      * produce, so wait until it is not full.
      */
-    while (fifo->full && *total_produced != WORK_MAX) {
-      printf ("prod %d:  FULL.\n", my_tid);
-      // wait until we get the broadcast that the queue is no longer full
-      pthread_cond_wait(fifo->notFull, fifo->mutex);
+    while (fifo->full && *total_produced != config.work_max) {
+      announce ("prod %d:  FULL.\n", my_tid);
+      // wait until we are told the queue is no longer full
+      queuePark(fifo, fifo->notFull, &fifo->notFullSeq, &fifo->fullWaiters,
+                &mydata->stats);
     }
 
     /*
      * Check to see if the total produced by all producers has reached
      * the configured maximum, if so, we can quit.
      */
-    if (*total_produced >= WORK_MAX) {
+    if (*total_produced >= config.work_max) {
       break;
     }
 
@@ -311,10 +1150,16 @@ void *producer (void *parg)
      * queue.
      */
     item_produced = (*total_produced)++;
+    was_empty     = fifo->empty;
     queueAdd (fifo, item_produced);
+    mydata->stats.items++;
+
+    // wake a consumer if the queue just stopped being empty
+    queueAdded(fifo, was_empty);
 
-    // broadcast that we've added something to the queue, so it can't be empty any longer
-    pthread_cond_broadcast(fifo->notEmpty);
+    // the last item releases every producer still waiting for room
+    if (*total_produced == config.work_max && fifo->fullWaiters > 0)
+      queueUnpark(fifo->notFull, &fifo->notFullSeq, 1);
 
     // we're done with queue now, release lock
     pthread_mutex_unlock(fifo->mutex);
@@ -322,28 +1167,29 @@ void *producer (void *parg)
     /*
      * Announce the production outside the critical section
      */
-    printf("prod %d:  %d.\n", my_tid, item_produced);
+    announce("prod %d:  %d.\n", my_tid, item_produced);
 
   }
 
   // unlock the mutex, since we exited the loop without unlocking it
   pthread_mutex_unlock(fifo->mutex);
 
-  printf("prod %d:  exited\n", my_tid);
+  announce("prod %d:  exited\n", my_tid);
   return (NULL);
 }
 
 void *consumer (void *carg)
 {
-  queue  *fifo;
-  int     item_consumed;
-  pcdata *mydata;
-  int     my_tid;
-  int    *total_consumed;
+  queue      *fifo;
+  int         item_consumed;
+  int         was_full;
+  pcdata     *mydata;
+  int         my_tid;
+  atomic_int *total_consumed;
 
   mydata = (pcdata *) carg;
 
-  fifo           = mydata->q;
+  fifo           = (queue *) mydata->q;
   total_consumed = mydata->count;
   my_tid         = mydata->tid;
 
@@ -354,23 +1200,24 @@ void *consumer (void *carg)
   while (1) {
 
     // acquire queue lock
-    pthread_mutex_lock(fifo->mutex);
+    statLock(fifo->mutex, &mydata->stats);
 
     /*
      * If the queue is empty, there is nothing to do, so wait until it
      * si not empty.
      */
-    while (fifo->empty && *total_consumed != WORK_MAX) {
-      printf ("con %d:   EMPTY.\n", my_tid);
-      // wait until it is broadcast that the queue is no longer empty
-      pthread_cond_wait(fifo->notEmpty, fifo->mutex);
+    while (fifo->empty && *total_consumed != config.work_max) {
+      announce ("con %d:   EMPTY.\n", my_tid);
+      // wait until we are told the queue is no longer empty
+      queuePark(fifo, fifo->notEmpty, &fifo->notEmptySeq, &fifo->emptyWaiters,
+                &mydata->stats);
     }
 
     /*
      * If total consumption has reached the configured limit, we can
      * stop
      */
-    if (*total_consumed >= WORK_MAX) {
+    if (*total_consumed >= config.work_max) {
       break;
     }
 
@@ -380,11 +1227,17 @@ void *consumer (void *carg)
      * thread can retain a memory of which item it consumed even if
      * others are busy consuming them.
      */
+    was_full = fifo->full;
     queueRemove (fifo, &item_consumed);
     (*total_consumed)++;
+    mydata->stats.items++;
 
-    // we've removed from the queue, so it can no longer be full
-    pthread_cond_broadcast(fifo->notFull);
+    // wake a producer if the queue just stopped being full
+    queueRemoved(fifo, was_full);
+
+    // the last item releases every consumer still waiting for one
+    if (*total_consumed == config.work_max && fifo->emptyWaiters > 0)
+      queueUnpark(fifo->notEmpty, &fifo->notEmptySeq, 1);
 
     // we're done with queue data, so unlock its mutex
     pthread_mutex_unlock(fifo->mutex);
@@ -393,52 +1246,591 @@ void *consumer (void *carg)
      * Do work outside the critical region to consume the item
      * obtained from the queue and then announce its consumption.
      */
-    do_work(CONSUMER_CPU,CONSUMER_CPU);
-    printf ("con %d:   %d.\n", my_tid, item_consumed);
+    do_work(config.consumer_cpu, config.consumer_block);
+    announce ("con %d:   %d.\n", my_tid, item_consumed);
 
   }
 
   pthread_mutex_unlock(fifo->mutex);
 
-  printf("con %d:   exited\n", my_tid);
+  announce("con %d:   exited\n", my_tid);
+  return (NULL);
+}
+
+/*
+ * Producer for the batch queue type. It claims a range of up to batch
+ * item numbers at once, does the work for all of them, and then adds
+ * them to the queue with as few lock acquisitions and broadcasts as
+ * the free space allows.
+ */
+void *batchProducer (void *parg)
+{
+  queue      *fifo;
+  int        *items;
+  int         batch;
+  int         first;
+  int         n;
+  int         added;
+  int         was_empty;
+  int         i;
+  pcdata     *mydata;
+  int         my_tid;
+  atomic_int *total_produced;
+
+  mydata = (pcdata *) parg;
+
+  fifo           = (queue *) mydata->q;
+  total_produced = mydata->count;
+  my_tid         = mydata->tid;
+
+  batch = config.batch > 0 ? config.batch : fifo->size;
+  items = (int *) malloc (sizeof (int) * batch);
+  if (items == NULL) {
+    fprintf (stderr, "prod %d: Batch allocation failed.\n", my_tid);
+    exit (1);
+  }
+
+  while (1) {
+    /*
+     * Claim the numbers of the next items to produce. Producers never
+     * claim past the configured maximum, so every claimed item is one
+     * some consumer is waiting for.
+     */
+    first = atomic_fetch_add (total_produced, batch);
+    if (first >= config.work_max) {
+      break;
+    }
+
+    n = config.work_max - first;
+    if (n > batch)
+      n = batch;
+
+    for (i = 0; i < n; i++) {
+      do_work(config.producer_cpu, config.producer_block);
+      items[i] = first + i;
+    }
+
+    /*
+     * Add the batch, waiting whenever the queue is full. Each pass
+     * through the loop adds as much as fits under a single lock.
+     */
+    statLock(fifo->mutex, &mydata->stats);
+
+    for (added = 0; added < n; ) {
+      while (fifo->full) {
+        announce ("prod %d:  FULL.\n", my_tid);
+        queuePark(fifo, fifo->notFull, &fifo->notFullSeq, &fifo->fullWaiters,
+                  &mydata->stats);
+      }
+
+      was_empty = fifo->empty;
+      added += queueAddN (fifo, items + added, n - added);
+      queueAdded(fifo, was_empty);
+    }
+
+    pthread_mutex_unlock(fifo->mutex);
+
+    mydata->stats.items += n;
+    for (i = 0; i < n; i++)
+      announce("prod %d:  %d.\n", my_tid, items[i]);
+  }
+
+  free (items);
+
+  announce("prod %d:  exited\n", my_tid);
+  return (NULL);
+}
+
+/*
+ * Consumer for the batch queue type. Each time it holds the lock it
+ * takes up to batch items, or everything in the queue when batch is
+ * zero, and consumes them outside the critical section.
+ */
+void *batchConsumer (void *carg)
+{
+  queue      *fifo;
+  int        *items;
+  int         n;
+  int         was_full;
+  int         i;
+  pcdata     *mydata;
+  int         my_tid;
+  atomic_int *total_consumed;
+
+  mydata = (pcdata *) carg;
+
+  fifo           = (queue *) mydata->q;
+  total_consumed = mydata->count;
+  my_tid         = mydata->tid;
+
+  items = (int *) malloc (sizeof (int) * fifo->size);
+  if (items == NULL) {
+    fprintf (stderr, "con %d: Batch allocation failed.\n", my_tid);
+    exit (1);
+  }
+
+  while (1) {
+    statLock(fifo->mutex, &mydata->stats);
+
+    while (fifo->empty && *total_consumed != config.work_max) {
+      announce ("con %d:   EMPTY.\n", my_tid);
+      queuePark(fifo, fifo->notEmpty, &fifo->notEmptySeq, &fifo->emptyWaiters,
+                &mydata->stats);
+    }
+
+    if (*total_consumed >= config.work_max) {
+      pthread_mutex_unlock(fifo->mutex);
+      break;
+    }
+
+    was_full = fifo->full;
+    if (config.batch > 0)
+      n = queueRemoveN (fifo, items, config.batch);
+    else
+      n = queueDrain (fifo, items);
+    *total_consumed += n;
+
+    queueRemoved(fifo, was_full);
+
+    /*
+     * Whoever takes the last items wakes the consumers still waiting
+     * on an empty queue so they can see there is nothing left
+     */
+    if (*total_consumed == config.work_max && fifo->emptyWaiters > 0)
+      queueUnpark(fifo->notEmpty, &fifo->notEmptySeq, 1);
+
+    pthread_mutex_unlock(fifo->mutex);
+
+    mydata->stats.items += n;
+    for (i = 0; i < n; i++) {
+      do_work(config.consumer_cpu, config.consumer_block);
+      announce ("con %d:   %d.\n", my_tid, items[i]);
+    }
+  }
+
+  free (items);
+
+  announce("con %d:   exited\n", my_tid);
+  return (NULL);
+}
+
+/*
+ * Producer for the lock-free ring. Instead of checking the shared
+ * total under a lock, each producer claims the number of the next
+ * item with an atomic increment and stops once the claimed number
+ * passes the configured maximum.
+ */
+void *lfProducer (void *parg)
+{
+  ring       *fifo;
+  int         item_produced;
+  pcdata     *mydata;
+  int         my_tid;
+  atomic_int *total_produced;
+
+  mydata = (pcdata *) parg;
+
+  fifo           = (ring *) mydata->q;
+  total_produced = mydata->count;
+  my_tid         = mydata->tid;
+
+  while (1) {
+    do_work(config.producer_cpu, config.producer_block);
+
+    item_produced = atomic_fetch_add (total_produced, 1);
+    if (item_produced >= config.work_max) {
+      break;
+    }
+
+    ringAdd (fifo, item_produced, &mydata->stats);
+    mydata->stats.items++;
+    announce("prod %d:  %d.\n", my_tid, item_produced);
+  }
+
+  announce("prod %d:  exited\n", my_tid);
+  return (NULL);
+}
+
+/*
+ * Consumer for the lock-free ring. Each consumer claims one of the
+ * work_max items before removing it, so every claim is matched by an
+ * item some producer will eventually add and no consumer is left
+ * waiting on an empty ring at the end.
+ */
+void *lfConsumer (void *carg)
+{
+  ring       *fifo;
+  int         item_consumed;
+  pcdata     *mydata;
+  int         my_tid;
+  atomic_int *total_consumed;
+
+  mydata = (pcdata *) carg;
+
+  fifo           = (ring *) mydata->q;
+  total_consumed = mydata->count;
+  my_tid         = mydata->tid;
+
+  while (1) {
+    if (atomic_fetch_add (total_consumed, 1) >= config.work_max) {
+      break;
+    }
+
+    ringRemove (fifo, &item_consumed, &mydata->stats);
+    mydata->stats.items++;
+
+    do_work(config.consumer_cpu, config.consumer_block);
+    announce ("con %d:   %d.\n", my_tid, item_consumed);
+  }
+
+  announce("con %d:   exited\n", my_tid);
+  return (NULL);
+}
+
+/*
+ * Producer for the lanes topology. Producer tid makes items tid,
+ * tid + pros, tid + 2 * pros and so on, so no shared counter is
+ * needed. Items are dealt round robin over the producer's lanes,
+ * skipping lanes that are full, and the producer only yields when all
+ * of them are.
+ */
+void *lanesProducer (void *parg)
+{
+  laneSet    *lanes;
+  lane       *mine;
+  int         item_produced;
+  int         next;
+  int         tried;
+  pcdata     *mydata;
+  int         my_tid;
+
+  mydata = (pcdata *) parg;
+
+  lanes  = (laneSet *) mydata->q;
+  my_tid = mydata->tid;
+  mine   = &lanes->lanes[my_tid * lanes->cons];
+
+  next = 0;
+  for (item_produced = my_tid; item_produced < config.work_max;
+       item_produced += lanes->pros) {
+    do_work(config.producer_cpu, config.producer_block);
+
+    for (tried = 0; !laneAdd (&mine[next], item_produced); ) {
+      next = (next + 1) % lanes->cons;
+
+      if (++tried == lanes->cons) {
+        announce ("prod %d:  FULL.\n", my_tid);
+        laneYield (&mydata->stats);
+        tried = 0;
+      }
+    }
+
+    next = (next + 1) % lanes->cons;
+    mydata->stats.items++;
+    announce("prod %d:  %d.\n", my_tid, item_produced);
+  }
+
+  atomic_fetch_add_explicit (&lanes->producersDone, 1, memory_order_release);
+
+  announce("prod %d:  exited\n", my_tid);
+  return (NULL);
+}
+
+/*
+ * Consumer for the lanes topology. It takes batches from its own lane
+ * of every producer and only when all of those are empty steals single
+ * items from the lanes of other consumers. Each scan starts at the
+ * producer after the one whose lane last gave it items, so every
+ * producer's lane is drained in turn rather than producer 0's first.
+ * It exits once every producer is done and every lane is empty.
+ */
+void *lanesConsumer (void *carg)
+{
+  laneSet    *lanes;
+  int        *items;
+  int         batch;
+  int         n;
+  int         p;
+  int         c;
+  int         i;
+  int         k;
+  int         first;
+  pcdata     *mydata;
+  int         my_tid;
+
+  mydata = (pcdata *) carg;
+
+  lanes  = (laneSet *) mydata->q;
+  my_tid = mydata->tid;
+
+  batch = config.batch > 0 ? config.batch : (int) lanes->lanes[0].mask + 1;
+  items = (int *) malloc (sizeof (int) * batch);
+  if (items == NULL) {
+    fprintf (stderr, "con %d: Batch allocation failed.\n", my_tid);
+    exit (1);
+  }
+
+  first = 0;
+  while (1) {
+    /*
+     * Our own lanes first
+     */
+    n = 0;
+    for (k = 0, p = first; k < lanes->pros && n == 0; k++) {
+      p = (first + k) % lanes->pros;
+      n = laneTake (&lanes->lanes[p * lanes->cons + my_tid], items, batch);
+    }
+
+    /*
+     * Then the other consumers' lanes, starting with our neighbour so
+     * thieves spread out
+     */
+    for (c = 1; c < lanes->cons && n == 0; c++)
+      for (k = 0; k < lanes->pros && n == 0; k++) {
+        p = (first + k) % lanes->pros;
+        n = laneSteal (&lanes->lanes[p * lanes->cons +
+                                     (my_tid + c) % lanes->cons], items);
+      }
+
+    if (n > 0)
+      first = (p + 1) % lanes->pros;
+
+    if (n == 0) {
+      /*
+       * Nothing found. If the producers are all done, we can leave
+       * once every lane is seen empty, otherwise wait for more.
+       */
+      if (atomic_load_explicit (&lanes->producersDone, memory_order_acquire)
+          == lanes->pros) {
+        for (i = 0; i < lanes->pros * lanes->cons; i++)
+          if (!laneEmpty (&lanes->lanes[i]))
+            break;
+
+        if (i == lanes->pros * lanes->cons)
+          break;
+      }
+
+      announce ("con %d:   EMPTY.\n", my_tid);
+      laneYield (&mydata->stats);
+      continue;
+    }
+
+    mydata->stats.items += n;
+    for (i = 0; i < n; i++) {
+      do_work(config.consumer_cpu, config.consumer_block);
+      announce ("con %d:   %d.\n", my_tid, items[i]);
+    }
+  }
+
+  free (items);
+
+  announce("con %d:   exited\n", my_tid);
   return (NULL);
 }
 
+/*
+ * The queue implementations that can be selected at runtime. Each
+ * provides its own producer and consumer routines since the way they
+ * wait and account for work differs.
+ */
+typedef struct {
+  const char *name;
+  void *(*init) (int size, int pros, int cons);
+  void  (*destroy) (void *q);
+  void *(*producer) (void *);
+  void *(*consumer) (void *);
+} queueType;
+
+void *mutexQueueInit (int size, int pros, int cons)
+{
+  return (queueInit (size));
+}
+
+void mutexQueueDelete (void *q)
+{
+  queueDelete ((queue *) q);
+}
+
+void *lockfreeQueueInit (int size, int pros, int cons)
+{
+  return (ringInit (size));
+}
+
+void lockfreeQueueDelete (void *q)
+{
+  ringDelete ((ring *) q);
+}
+
+void *lanesQueueInit (int size, int pros, int cons)
+{
+  return (laneSetInit (size, pros, cons));
+}
+
+void lanesQueueDelete (void *q)
+{
+  laneSetDelete ((laneSet *) q);
+}
+
+const queueType queue_types[] = {
+  { "mutex",    mutexQueueInit,    mutexQueueDelete,    producer,      consumer      },
+  { "batch",    mutexQueueInit,    mutexQueueDelete,    batchProducer, batchConsumer },
+  { "lockfree", lockfreeQueueInit, lockfreeQueueDelete, lfProducer,    lfConsumer    },
+  { "lanes",    lanesQueueInit,    lanesQueueDelete,    lanesProducer, lanesConsumer },
+};
+
+#define NUM_QUEUE_TYPES (sizeof (queue_types) / sizeof (queue_types[0]))
+
 /***************************************************
  *   Main allocates structures, creates threads,   *
  *   waits to tear down.                           *
  ***************************************************/
+void usage (void)
+{
+  printf("Usage: producer_consumer [options] number_of_producers number_of_consumers\n");
+  printf("  -t type   queue type: mutex (default), batch, lockfree or lanes\n");
+  printf("  -s size   capacity of the shared queue (default %d)\n", QUEUESIZE);
+  printf("  -n items  total items to produce and consume (default %d)\n", WORK_MAX);
+  printf("  -c cpu    producer CPU work per item (default %d)\n", PRODUCER_CPU);
+  printf("  -b ms     producer blocking time per item (default %d)\n", PRODUCER_BLOCK);
+  printf("  -C cpu    consumer CPU work per item (default %d)\n", CONSUMER_CPU);
+  printf("  -B ms     consumer blocking time per item (default %d)\n", CONSUMER_BLOCK);
+  printf("  -p park   how mutex and batch queues park waiters: cond (default) or futex\n");
+  printf("  -k items  items per batch for the batch and lanes types, 0 for all (default %d)\n", BATCH_SIZE);
+  printf("  -q        quiet, only print the final report\n");
+}
+
+/*
+ * Print the throughput of the run and the context switches taken
+ * since the before snapshot, followed by the counters of each thread
+ */
+void report (const char *type, double elapsed, struct rusage *before,
+             pcdata *pro_args, int pros, pcdata *con_args, int cons)
+{
+  struct rusage after;
+  pcstats      *st;
+  int           i;
+
+  getrusage (RUSAGE_SELF, &after);
+
+  printf ("queue %s, %d producers, %d consumers, %d items in %.3f s: %.1f items/sec\n",
+          type, pros, cons, config.work_max, elapsed,
+          elapsed > 0 ? config.work_max / elapsed : 0.0);
+
+  printf ("context switches: %ld voluntary, %ld involuntary\n",
+          after.ru_nvcsw - before->ru_nvcsw,
+          after.ru_nivcsw - before->ru_nivcsw);
+
+  printf ("%-8s %10s %8s %10s %10s %10s\n",
+          "thread", "items", "waits", "wait (s)", "contended", "lock (s)");
+
+  for (i = 0; i < pros + cons; i++) {
+    st = i < pros ? &pro_args[i].stats : &con_args[i - pros].stats;
+
+    printf ("%-4s %3d %10ld %8ld %10.4f %10ld %10.4f\n",
+            i < pros ? "prod" : "con", i < pros ? i : i - pros,
+            st->items, st->waits, st->wait_time, st->contended,
+            st->lock_time);
+  }
+}
+
 int main (int argc, char *argv[])
 {
-  pthread_t *con;
-  int        cons;
-  int       *concount;
+  pthread_t  *con;
+  int         cons;
+  atomic_int *concount;
+
+  void       *fifo;
+  int         i;
+  int         opt;
+
+  pthread_t  *pro;
+  atomic_int *procount;
+  int         pros;
+
+  pcdata     *pro_args;
+  pcdata     *con_args;
+
+  double        start;
+  struct rusage rusage_start;
+
+  const queueType *type;
+
+  /*
+   * Select the queue implementation, the mutex protected queue by
+   * default
+   */
+  type = &queue_types[0];
+
+  while ((opt = getopt (argc, argv, "t:s:n:c:b:C:B:k:p:q")) != -1) {
+    switch (opt) {
+    case 't':
+      for (type = NULL, i = 0; i < NUM_QUEUE_TYPES; i++)
+        if (strcmp (optarg, queue_types[i].name) == 0)
+          type = &queue_types[i];
+
+      if (type == NULL) {
+        fprintf (stderr, "main: Unknown queue type %s\n", optarg);
+        exit (1);
+      }
+      break;
+
+    case 's': config.queue_size     = atoi (optarg); break;
+    case 'n': config.work_max       = atoi (optarg); break;
+    case 'c': config.producer_cpu   = atoi (optarg); break;
+    case 'b': config.producer_block = atoi (optarg); break;
+    case 'C': config.consumer_cpu   = atoi (optarg); break;
+    case 'B': config.consumer_block = atoi (optarg); break;
+    case 'k': config.batch          = atoi (optarg); break;
+
+    case 'p':
+      if (strcmp (optarg, "cond") == 0)
+        config.park = PARK_COND;
+      else if (strcmp (optarg, "futex") == 0)
+        config.park = PARK_FUTEX;
+      else {
+        fprintf (stderr, "main: Unknown parking mode %s\n", optarg);
+        exit (1);
+      }
+      break;
 
-  queue     *fifo;
-  int        i;
+    case 'q': config.quiet          = 1;             break;
 
-  pthread_t *pro;
-  int       *procount;
-  int        pros;
+    default:
+      usage ();
+      exit (1);
+    }
+  }
 
-  pcdata    *thread_args;
+  if (config.queue_size < 1 || config.work_max < 0 || config.batch < 0) {
+    fprintf (stderr, "main: Queue size must be positive, items and batch non-negative\n");
+    exit (1);
+  }
 
   /*
    * Check the number of arguments and determine the numebr of
    * producers and consumers
    */
-  if (argc != 3) {
-    printf("Usage: producer_consumer number_of_producers number_of_consumers\n");
+  if (argc - optind != 2) {
+    usage ();
     exit(0);
   }
 
-  pros = atoi(argv[1]);
-  cons = atoi(argv[2]);
+  pros = atoi(argv[optind]);
+  cons = atoi(argv[optind + 1]);
+
+  /*
+   * The lanes queue divides by both counts, and nothing could be
+   * produced or consumed without them anyway
+   */
+  if (pros < 1 || cons < 1) {
+    usage ();
+    exit (1);
+  }
 
   /*
    * Create the shared queue
    */
-  fifo = queueInit ();
+  fifo = type->init (config.queue_size, pros, cons);
   if (fifo ==  NULL) {
     fprintf (stderr, "main: Queue Init failed.\n");
     exit (1);
@@ -447,19 +1839,22 @@ int main (int argc, char *argv[])
   /*
    * Create a counter tracking how many items were produced, shared
    * among all producers, and one to track how many items were
-   * consumed, shared among all consumers.
+   * consumed, shared among all consumers. Each gets a cache line of
+   * its own, so producers and consumers do not contend on one line.
    */
-  procount = (int *) malloc (sizeof (int));
+  procount = (atomic_int *) cacheAlloc (sizeof (atomic_int));
   if (procount == NULL) {
     fprintf(stderr, "procount allocation failed\n");
     exit(1);
   }
+  atomic_init (procount, 0);
 
-  concount = (int *) malloc (sizeof (int));
+  concount = (atomic_int *) cacheAlloc (sizeof (atomic_int));
   if (concount == NULL) {
     fprintf(stderr, "concount allocation failed\n");
     exit(1);
   }
+  atomic_init (concount, 0);
 
   /*
    * Create arrays of thread structures, one for each producer and
@@ -477,26 +1872,32 @@ int main (int argc, char *argv[])
     exit(1);
   }
 
+  /*
+   * Allocate the arguments of every producer and consumer. They are
+   * kept until the end so the statistics in them can be reported.
+   */
+  pro_args = (pcdata *)cacheAlloc (sizeof (pcdata) * pros);
+  con_args = (pcdata *)cacheAlloc (sizeof (pcdata) * cons);
+  if ((pro_args == NULL && pros > 0) || (con_args == NULL && cons > 0)) {
+    fprintf (stderr, "main: Thread_Args Init failed.\n");
+    exit (1);
+  }
+
+  getrusage (RUSAGE_SELF, &rusage_start);
+  start = timeNow ();
+
   /*
    * Create the specified number of producers
    */
   for (i=0; i<pros; i++){
     /*
-     * Allocate memory for each producer's arguments
-     */
-    thread_args = (pcdata *)malloc (sizeof (pcdata));
-    if (thread_args == NULL) {
-      fprintf (stderr, "main: Thread_Args Init failed.\n");
-      exit (1);
-    }
-
-    /*
-     * Fill them in and then create the producer thread
+     * Fill in each producer's arguments and then create the producer
+     * thread
      */
-    thread_args->q     = fifo;
-    thread_args->count = procount;
-    thread_args->tid   = i;
-    pthread_create (&pro[i], NULL, producer, thread_args);
+    pro_args[i].q     = fifo;
+    pro_args[i].count = procount;
+    pro_args[i].tid   = i;
+    pthread_create (&pro[i], NULL, type->producer, &pro_args[i]);
   }
 
   /*
@@ -504,21 +1905,12 @@ int main (int argc, char *argv[])
    */
   for (i=0; i<cons; i++){
     /*
-     * Allocate space for next consumer's args
-     */
-    thread_args = (pcdata *)malloc (sizeof (pcdata));
-    if (thread_args == NULL) {
-      fprintf (stderr, "main: Thread_Args Init failed.\n");
-      exit (1);
-    }
-
-    /*
-     * Fill them in and create the thread
+     * Fill in each consumer's arguments and create the thread
      */
-    thread_args->q     = fifo;
-    thread_args->count = concount;
-    thread_args->tid   = i;
-    pthread_create (&con[i], NULL, consumer, thread_args);
+    con_args[i].q     = fifo;
+    con_args[i].count = concount;
+    con_args[i].tid   = i;
+    pthread_create (&con[i], NULL, type->consumer, &con_args[i]);
   }
 
   /*
@@ -532,12 +1924,22 @@ int main (int argc, char *argv[])
   for (i=0; i<cons; i++)
     pthread_join (con[i], NULL);
 
+  report (type->name, timeNow () - start, &rusage_start, pro_args, pros, con_args,
+          cons);
+
   /*
    * Delete the shared fifo, now that we know there are no users of
    * it. Since we are about to exit we could skip this step, but we
    * put it here for neatness' sake.
    */
-  queueDelete (fifo);
+  type->destroy (fifo);
+
+  free (pro_args);
+  free (con_args);
+  free (pro);
+  free (con);
+  free (procount);
+  free (concount);
 
   return 0;
 }
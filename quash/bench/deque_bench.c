@@ -0,0 +1,161 @@
+/**
+ * @file deque_bench.c
+ *
+ * @brief Micro-benchmark for the push_back heavy string building done by the
+ * parser with the deques generated by deque.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "deque.h"
+#include "memory_pool.h"
+
+IMPLEMENT_DEQUE_STRUCT(StrBuilder, char);
+IMPLEMENT_DEQUE_STRUCT(MPStrBuilder, char);
+
+IMPLEMENT_DEQUE(StrBuilder, char);
+IMPLEMENT_DEQUE_MEMORY_POOL(MPStrBuilder, char);
+
+// Total number of characters pushed for each string length
+#define CHARS_PER_RUN (1 << 24)
+
+// Keeps the compiler from optimizing the built strings away
+static volatile char sink;
+
+// Nanoseconds elapsed on the monotonic clock since start
+static double ns_since(const struct timespec* start) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+// Baseline: append to a plain realloc()'d array
+static double bench_raw(size_t len) {
+  struct timespec start;
+  size_t reps = CHARS_PER_RUN / len;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (size_t r = 0; r < reps; ++r) {
+    size_t cap = 16;
+    size_t n = 0;
+    char* str = malloc(cap);
+
+    for (size_t i = 0; i < len; ++i) {
+      if (n == cap)
+        str = realloc(str, cap *= 2);
+
+      str[n++] = 'a' + i % 26;
+    }
+
+    sink = str[len - 1];
+    free(str);
+  }
+
+  return ns_since(&start) / (reps * len);
+}
+
+// Build each string with push_back_StrBuilder() then take it with
+// as_array_StrBuilder(). If wrap is set a few characters are pushed on the
+// front first so as_array_StrBuilder() has to realign the contents.
+static double bench_str_builder(size_t len, bool wrap) {
+  struct timespec start;
+  size_t reps = CHARS_PER_RUN / len;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (size_t r = 0; r < reps; ++r) {
+    StrBuilder bld = new_StrBuilder(16);
+    size_t i = 0;
+
+    if (wrap)
+      for (; i < 4 && i < len; ++i)
+        push_front_StrBuilder(&bld, 'a' + i % 26);
+
+    for (; i < len; ++i)
+      push_back_StrBuilder(&bld, 'a' + i % 26);
+
+    char* str = as_array_StrBuilder(&bld, NULL);
+
+    sink = str[len - 1];
+    free(str);
+  }
+
+  return ns_since(&start) / (reps * len);
+}
+
+// Build each string from runs of up to 8 characters with
+// push_back_n_StrBuilder(), the way the parser copies the plain runs of a token
+static double bench_str_builder_bulk(size_t len) {
+  static const char run[] = "abcdefgh";
+  struct timespec start;
+  size_t reps = CHARS_PER_RUN / len;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (size_t r = 0; r < reps; ++r) {
+    StrBuilder bld = new_StrBuilder(16);
+
+    for (size_t i = 0; i < len; i += 8)
+      push_back_n_StrBuilder(&bld, run, len - i < 8 ? len - i : 8);
+
+    char* str = as_array_StrBuilder(&bld, NULL);
+
+    sink = str[len - 1];
+    free(str);
+  }
+
+  return ns_since(&start) / (reps * len);
+}
+
+// Same as bench_str_builder() but with the memory pool backed builder used for
+// parser tokens. The pool is reset after every string like quash does after
+// every line.
+static double bench_mp_str_builder(size_t len) {
+  struct timespec start;
+  size_t reps = CHARS_PER_RUN / len;
+
+  initialize_memory_pool(1024);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (size_t r = 0; r < reps; ++r) {
+    MPStrBuilder bld = new_MPStrBuilder(64);
+
+    for (size_t i = 0; i < len; ++i)
+      push_back_MPStrBuilder(&bld, 'a' + i % 26);
+
+    char* str = as_array_MPStrBuilder(&bld, NULL);
+
+    sink = str[len - 1];
+    memory_pool_reset();
+  }
+
+  double ret = ns_since(&start) / (reps * len);
+
+  destroy_memory_pool();
+
+  return ret;
+}
+
+int main(int argc, char** argv) {
+  static const size_t lens[] = { 8, 64, 1024, 65536 };
+
+  printf("%8s %12s %12s %12s %12s %12s\n", "length", "raw", "StrBuilder",
+         "wrapped", "bulk", "MPStrBuilder");
+
+  for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); ++i) {
+    printf("%8zu %9.2f ns %9.2f ns %9.2f ns %9.2f ns %9.2f ns\n", lens[i],
+           bench_raw(lens[i]), bench_str_builder(lens[i], false),
+           bench_str_builder(lens[i], true), bench_str_builder_bulk(lens[i]),
+           bench_mp_str_builder(lens[i]));
+  }
+
+  puts("(nanoseconds per character appended)");
+
+  return EXIT_SUCCESS;
+}
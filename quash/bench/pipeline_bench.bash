@@ -0,0 +1,53 @@
+#!/bin/bash
+
+# Measures the throughput of quash pipelines made of N `cat` stages, with the
+# default pipe size and with pipes enlarged through QUASH_PIPE_SIZE.
+#
+# Usage: ./bench/pipeline_bench.bash [MiB] [stage counts...]
+
+if [ ! -e "./quash" ]; then
+    echo "This script must be run from the quash directory after building quash" 1>&2
+    exit 1
+fi
+
+SIZE_MIB=${1:-256}
+shift
+STAGES=${@:-1 2 4 8 16 32}
+PIPE_SIZES="0 1048576"
+
+TMP_DIR=$(mktemp -d)
+trap "rm -rf $TMP_DIR" EXIT
+
+DATA=$TMP_DIR/data
+SCRIPT=$TMP_DIR/pipeline.qsh
+
+head -c $((SIZE_MIB * 1024 * 1024)) /dev/urandom > $DATA
+
+# Builds a quash script running the data through $1 cat processes
+make_script() {
+    local line="cat < $DATA"
+
+    for ((i = 1; i < $1; i++)); do
+        line="$line | cat"
+    done
+
+    echo "$line > /dev/null" > $SCRIPT
+}
+
+printf "%8s %12s %12s\n" "stages" "pipe size" "MB/s"
+
+for n in $STAGES; do
+    make_script $n
+
+    for size in $PIPE_SIZES; do
+        start=$(date +%s%N)
+        QUASH_PIPE_SIZE=$size ./quash -f $SCRIPT 2> /dev/null
+        end=$(date +%s%N)
+
+        label=$size
+        [ "$size" = "0" ] && label="default"
+
+        awk -v n=$n -v label=$label -v mib=$SIZE_MIB -v ns=$((end - start)) \
+            'BEGIN { printf "%8d %12s %12.1f\n", n, label, mib * 1048576 / (ns / 1e3) }'
+    done
+done
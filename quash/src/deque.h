@@ -11,6 +11,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /**
  * @def IMPLEMENT_DEQUE_STRUCT(struct_name, type)
@@ -68,6 +69,7 @@
   void apply_##struct_name(struct_name*, void (*)(type));               \
   void push_front_##struct_name(struct_name*, type);                    \
   void push_back_##struct_name(struct_name*, type);                     \
+  void push_back_n_##struct_name(struct_name*, const type*, size_t);    \
   type pop_front_##struct_name(struct_name*);                           \
   type pop_back_##struct_name(struct_name*);                            \
   type peek_front_##struct_name(struct_name*);                          \
@@ -83,12 +85,15 @@
  * @brief Generates a @a malloc based set of functions for use with a structure
  * generated by @a IMPLEMENT_DEQUE_STRUCT()
  *
+ * The array backing the deque grows in place with @a realloc() when it fills
+ * up and its capacity is always kept at a power of two.
+ *
  * @param struct_name The name of the structure
  *
  * @param type The name of the type of elements stored in the @a struct_name
  * structure
  *
- * @sa IMPLEMENT_DEQUE_STRUCT(), PROTOTYPE_DEQUE()
+ * @sa IMPLEMENT_DEQUE_STRUCT(), PROTOTYPE_DEQUE(), IMPLEMENT_DEQUE_COMMON()
  */
 #define IMPLEMENT_DEQUE(struct_name, type)                              \
                                                                         \
@@ -97,10 +102,10 @@
   struct_name new_##struct_name(size_t init_cap) {                      \
     struct_name ret;                                                    \
                                                                         \
-    if (init_cap > 0)                                                   \
-      ret.cap = init_cap;                                               \
-    else                                                                \
-      ret.cap = 1;                                                      \
+    /* Round the capacity up to a power of two */                       \
+    ret.cap = 1;                                                        \
+    while (ret.cap < init_cap)                                          \
+      ret.cap <<= 1;                                                    \
                                                                         \
     ret.data = (type*) malloc(ret.cap * sizeof(type));                  \
                                                                         \
@@ -139,6 +144,71 @@
     deq->cap = deq->front = deq->back = 0;                              \
   }                                                                     \
                                                                         \
+  static void __reserve_##struct_name(struct_name* deq, size_t n) {     \
+    size_t len = (deq->back - deq->front) & (deq->cap - 1);             \
+                                                                        \
+    /* One slot stays open to tell a full ring from an empty one */     \
+    if (len + n < deq->cap)                                             \
+      return;                                                           \
+                                                                        \
+    size_t old_cap = deq->cap;                                          \
+    size_t cap = old_cap;                                               \
+                                                                        \
+    while (len + n >= cap)                                              \
+      cap <<= 1;                                                        \
+                                                                        \
+    type* data = (type*) realloc(deq->data, cap * sizeof(type));        \
+                                                                        \
+    if (data == NULL) {                                                 \
+      fprintf(stderr, "ERROR: Failed to reallocate struct_name"         \
+              " contents\n");                                           \
+      abort();                                                          \
+    }                                                                   \
+                                                                        \
+    deq->data = data;                                                   \
+    deq->cap = cap;                                                     \
+                                                                        \
+    /* If the contents wrapped past the end of the old array, move */   \
+    /* the shorter of the two runs so they are contiguous again */      \
+    if (deq->back < deq->front) {                                       \
+      size_t tail = old_cap - deq->front;                               \
+                                                                        \
+      if (deq->back <= tail) {                                          \
+        memcpy(deq->data + old_cap, deq->data,                          \
+               deq->back * sizeof(type));                               \
+        deq->back += old_cap;                                           \
+      }                                                                 \
+      else {                                                            \
+        memcpy(deq->data + deq->front + cap - old_cap,                  \
+               deq->data + deq->front, tail * sizeof(type));            \
+        deq->front += cap - old_cap;                                    \
+      }                                                                 \
+    }                                                                   \
+  }                                                                     \
+                                                                        \
+  IMPLEMENT_DEQUE_COMMON(struct_name, type)
+
+/**
+ * @def IMPLEMENT_DEQUE_COMMON(struct_name, type)
+ *
+ * @brief Generates the functions shared by every deque implementation
+ * regardless of how the underlying array is allocated
+ *
+ * The capacity of a deque is always a power of two so every index wraps with a
+ * bit mask rather than a division. This macro expects @a new_struct_name(), @a
+ * new_destructable_struct_name(), @a destroy_struct_name() and a static @a
+ * __reserve_struct_name() function, which grows the array until a given
+ * number of additional elements fit, to be defined before it is expanded.
+ *
+ * @param struct_name The name of the structure
+ *
+ * @param type The name of the type of elements stored in the @a struct_name
+ * structure
+ *
+ * @sa IMPLEMENT_DEQUE(), IMPLEMENT_DEQUE_MEMORY_POOL()
+ */
+#define IMPLEMENT_DEQUE_COMMON(struct_name, type)                       \
+                                                                        \
   void empty_##struct_name(struct_name* deq) {                          \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
@@ -158,35 +228,50 @@
   size_t length_##struct_name(struct_name* deq) {                       \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    return (deq->back - deq->front + deq->cap) % deq->cap;              \
+    return (deq->back - deq->front) & (deq->cap - 1);                   \
+  }                                                                     \
+                                                                        \
+  static void __reverse_##struct_name(type* data, size_t len) {         \
+    for (size_t i = 0, j = len; i + 1 < j; ++i) {                       \
+      type tmp = data[i];                                               \
+      data[i] = data[--j];                                              \
+      data[j] = tmp;                                                    \
+    }                                                                   \
   }                                                                     \
                                                                         \
   static void __reallign_##struct_name(struct_name* deq) {              \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
                                                                         \
-    if (deq->front != 0) {                                              \
-      type* old_data = deq->data;                                       \
-      size_t len = length_##struct_name(deq);                           \
+    if (deq->front == 0)                                                \
+      return;                                                           \
                                                                         \
-      deq->data = (type*) malloc(deq->cap * sizeof(type));              \
+    size_t len = length_##struct_name(deq);                             \
                                                                         \
-      if (deq->data == NULL) {                                          \
-        fprintf(stderr, "ERROR: Failed to reallocate struct_name"       \
-                " contents");                                           \
-        abort();                                                        \
+    if (deq->front <= deq->back) {                                      \
+      /* Contents are contiguous. Slide them down to the start */       \
+      memmove(deq->data, deq->data + deq->front, len * sizeof(type));   \
+    }                                                                   \
+    else {                                                              \
+      size_t tail = deq->cap - deq->front; /* Run in [front, cap) */    \
+      size_t head = deq->back;             /* Run in [0, back) */       \
+                                                                        \
+      if (tail <= deq->front - deq->back) {                             \
+        /* The tail fits in the free gap. Shift the head up past */     \
+        /* it and then copy the tail down to the start */               \
+        memmove(deq->data + tail, deq->data, head * sizeof(type));      \
+        memcpy(deq->data, deq->data + deq->front, tail * sizeof(type)); \
+      }                                                                 \
+      else {                                                            \
+        /* Not enough free space. Rotate the array in place instead */  \
+        __reverse_##struct_name(deq->data, deq->front);                 \
+        __reverse_##struct_name(deq->data + deq->front, tail);          \
+        __reverse_##struct_name(deq->data, deq->cap);                   \
       }                                                                 \
-                                                                        \
-      size_t i;                                                         \
-                                                                        \
-      for (i = 0; i < len; ++i)                                         \
-        deq->data[i] = old_data[(deq->front + i) % deq->cap];           \
-                                                                        \
-      free(old_data);                                                   \
-                                                                        \
-      deq->front = 0;                                                   \
-      deq->back = i;                                                    \
     }                                                                   \
+                                                                        \
+    deq->front = 0;                                                     \
+    deq->back = len;                                                    \
   }                                                                     \
                                                                         \
   type* as_array_##struct_name(struct_name* deq, size_t* len) {         \
@@ -211,35 +296,10 @@
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
                                                                         \
     size_t len = length_##struct_name(deq);                             \
+    size_t mask = deq->cap - 1;                                         \
                                                                         \
     for (size_t i = 0; i < len; ++i) {                                  \
-      func(deq->data[(deq->front + i) % deq->cap]);                     \
-    }                                                                   \
-  }                                                                     \
-                                                                        \
-  static void __on_push_##struct_name(struct_name* deq) {               \
-    if (deq->front == (deq->back + 1) % deq->cap) {                     \
-      type* old_data = deq->data;                                       \
-      size_t old_cap = deq->cap;                                        \
-                                                                        \
-      deq->cap = 2 * deq->cap;                                          \
-      deq->data = (type*) malloc(deq->cap * sizeof(type));              \
-                                                                        \
-      if (deq->data == NULL) {                                          \
-        fprintf(stderr, "ERROR: Failed to reallocate struct_name"       \
-                " contents\n");                                         \
-        abort();                                                        \
-      }                                                                 \
-                                                                        \
-      size_t i;                                                         \
-                                                                        \
-      for (i = 0; i < old_cap - 1; ++i)                                 \
-        deq->data[i] = old_data[(deq->front + i) % old_cap];            \
-                                                                        \
-      free(old_data);                                                   \
-                                                                        \
-      deq->front = 0;                                                   \
-      deq->back = i;                                                    \
+      func(deq->data[(deq->front + i) & mask]);                         \
     }                                                                   \
   }                                                                     \
                                                                         \
@@ -254,17 +314,35 @@
   void push_front_##struct_name(struct_name* deq, type element) {       \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    __on_push_##struct_name(deq);                                       \
-    deq->front = (deq->front + deq->cap - 1) % deq->cap;                \
+    __reserve_##struct_name(deq, 1);                                    \
+    deq->front = (deq->front - 1) & (deq->cap - 1);                     \
     deq->data[deq->front] = element;                                    \
   }                                                                     \
                                                                         \
   void push_back_##struct_name(struct_name* deq, type element) {        \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    __on_push_##struct_name(deq);                                       \
+    __reserve_##struct_name(deq, 1);                                    \
     deq->data[deq->back] = element;                                     \
-    deq->back = (deq->back + 1) % deq->cap;                             \
+    deq->back = (deq->back + 1) & (deq->cap - 1);                       \
+  }                                                                     \
+                                                                        \
+  void push_back_n_##struct_name(struct_name* deq,                      \
+                                 const type* elements, size_t n) {      \
+    assert(deq != NULL);                                                \
+    assert(deq->data != NULL); /* Make sure the structure is valid */   \
+    assert(elements != NULL || n == 0);                                 \
+    __reserve_##struct_name(deq, n);                                    \
+                                                                        \
+    /* Fill to the end of the array and wrap the rest to the start */   \
+    size_t first = deq->cap - deq->back;                                \
+                                                                        \
+    if (first > n)                                                      \
+      first = n;                                                        \
+                                                                        \
+    memcpy(deq->data + deq->back, elements, first * sizeof(type));      \
+    memcpy(deq->data, elements + first, (n - first) * sizeof(type));    \
+    deq->back = (deq->back + n) & (deq->cap - 1);                       \
   }                                                                     \
                                                                         \
   type pop_front_##struct_name(struct_name* deq) {                      \
@@ -272,7 +350,7 @@
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     __on_pop_##struct_name(deq);                                        \
     size_t old_front = deq->front;                                      \
-    deq->front = (deq->front + 1) % deq->cap;                           \
+    deq->front = (deq->front + 1) & (deq->cap - 1);                     \
     return deq->data[old_front];                                        \
   }                                                                     \
                                                                         \
@@ -280,7 +358,7 @@
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     __on_pop_##struct_name(deq);                                        \
-    deq->back = (deq->back + deq->cap - 1) % deq->cap;                  \
+    deq->back = (deq->back - 1) & (deq->cap - 1);                       \
     return deq->data[deq->back];                                        \
   }                                                                     \
                                                                         \
@@ -295,7 +373,7 @@
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     assert(!is_empty_##struct_name(deq));                               \
-    return deq->data[(deq->back + deq->cap - 1) % deq->cap];            \
+    return deq->data[(deq->back - 1) & (deq->cap - 1)];                 \
   }                                                                     \
                                                                         \
   void update_front_##struct_name(struct_name* deq, type element) {     \
@@ -309,7 +387,7 @@
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     assert(!is_empty_##struct_name(deq));                               \
-    deq->data[(deq->back + deq->cap - 1) % deq->cap] = element;         \
+    deq->data[(deq->back - 1) & (deq->cap - 1)] = element;              \
   }                                                                     \
                                                                         \
   void update_and_destroy_front_##struct_name(struct_name* deq,         \
@@ -332,7 +410,7 @@
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     assert(!is_empty_##struct_name(deq));                               \
                                                                         \
-    size_t idx = (deq->back + deq->cap - 1) % deq->cap;                 \
+    size_t idx = (deq->back - 1) & (deq->cap - 1);                      \
                                                                         \
     if (deq->destructor != NULL)                                        \
       deq->destructor(deq->data[idx]);                                  \
@@ -381,7 +459,8 @@ typedef struct Example {
  *
  * @brief Create a new, fully initialized deque structure
  *
- * @param init_cap Initial capacity of the deque
+ * @param init_cap Initial capacity of the deque. This is rounded up to the
+ * next power of two.
  *
  * @return A copy of the fully initialized struct
  *
@@ -397,7 +476,8 @@ typedef struct Example {
  * Specifying the destructor is useful to not have to manually iterate over the
  * deque destroying any malloc'd memory in each element.
  *
- * @param init_cap Initial capacity of the deque
+ * @param init_cap Initial capacity of the deque. This is rounded up to the
+ * next power of two.
  *
  * @param destructor A function that is run on each element in the deque when @a
  * destroy_Example() is called
@@ -506,6 +586,22 @@ typedef struct Example {
  *
  * @sa Example, Type
  */
+/**
+ * @fn void push_back_n_Example(Example* deq, const Type* elements, size_t n)
+ *
+ * @brief Insert an array of elements at the back of the deque in order
+ *
+ * This is equivalent to calling @a push_back_Example() on each element but the
+ * deque grows at most once and the elements are copied in bulk.
+ *
+ * @param deq A pointer to the deque to insert the elements
+ *
+ * @param elements An array of at least n elements to insert
+ *
+ * @param n The number of elements to insert
+ *
+ * @sa Example, Type
+ */
 /**
  * @fn Type pop_front_Example(Example* deq)
  *
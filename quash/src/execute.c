@@ -7,6 +7,8 @@
  * @note As you add things to this file you may want to change the method signature
  */
 
+#define _GNU_SOURCE // pipe2() and F_SETPIPE_SZ
+
 #include "execute.h"
 
 #include <stdio.h>
@@ -121,9 +123,9 @@ PIDDeque current_job; /**< contains a list of pids associated with the job runni
 JobDeque bg_jobs; /**< contains all of the jobs executing in the background */
 
 // declare pipes
-int pipes[2][2]; /**< used for piping input and output between processes */
-int cur_pipe = 0; /**< id of the next pipe to be used - pipes are alternated */
-int old_pipe = 1; /**< id of the pipe that was last used (always = cur_pipe+1%2) */
+int (*pipes)[2] = NULL; /**< pool of pipes for the current job - pipes[i] carries the output of process i to process i+1 */
+size_t pipes_cap = 0; /**< number of pipes the pool has room for - the pool is reused between jobs */
+size_t num_pipes = 0; /**< number of pipes currently open in the pool */
 
 int status; /**< used for passing into waitpid and storing returned status */
 
@@ -160,6 +162,73 @@ void cleanup_globals(){
   destroy_PIDDeque(&current_job);
   destroy_JobDeque(&bg_jobs);
 
+  free(pipes);
+
+}
+
+
+
+/**
+ * @brief opens every pipe needed to connect the processes of a job
+ *
+ * All of the pipes are created before any process is forked so each process
+ * can be started as soon as possible. The pipes are created close-on-exec, so a
+ * program started with execvp only keeps the ends it duplicated onto its
+ * standard in and out. If the QUASH_PIPE_SIZE environment variable is set the
+ * capacity of each pipe is raised to that many bytes, which helps pipelines
+ * moving a lot of data. The kernel rounds the size up to a power of two pages
+ * and refuses sizes above /proc/sys/fs/pipe-max-size, in which case the pipe
+ * keeps its default size.
+ *
+ * @param n the number of pipes to open
+ *
+ * @return true if every pipe was opened, false if one could not be, in which
+ * case the ones opened before it are left for close_pipes
+ */
+bool open_pipes(size_t n){
+
+  if(n > pipes_cap){
+    pipes = realloc(pipes, n * sizeof(*pipes));
+
+    if(pipes == NULL){
+      perror("ERROR: Failed to allocate pipes");
+      exit(EXIT_FAILURE);
+    }
+
+    pipes_cap = n;
+  }
+
+  const char* size_str = lookup_env("QUASH_PIPE_SIZE");
+  int size = size_str != NULL ? atoi(size_str) : 0;
+
+  for(num_pipes = 0; num_pipes < n; num_pipes++){
+    if(pipe2(pipes[num_pipes], O_CLOEXEC) < 0){
+      perror("ERROR: Failed to create pipe");
+      return false;
+    }
+
+    if(size > 0){
+      fcntl(pipes[num_pipes][1], F_SETPIPE_SZ, size);
+    }
+  }
+
+  return true;
+}
+
+
+
+/**
+ * @brief closes every pipe opened by open_pipes
+ */
+void close_pipes(){
+
+  for(size_t i = 0; i < num_pipes; i++){
+    close(pipes[i][0]);
+    close(pipes[i][1]);
+  }
+
+  num_pipes = 0;
+
 }
 
 
@@ -518,9 +587,12 @@ void parent_run_command(Command cmd) {
  *
  * @param holder The CommandHolder to try to run
  *
+ * @param index The position of the process in its job. The process reads from
+ * pipes[index-1] and writes to pipes[index] when piping is requested.
+ *
  * @sa Command CommandHolder
  */
-void create_process(CommandHolder holder) {
+void create_process(CommandHolder holder, size_t index) {
   // Read the flags field from the parser
   bool p_in  = holder.flags & PIPE_IN;
   bool p_out = holder.flags & PIPE_OUT;
@@ -529,9 +601,6 @@ void create_process(CommandHolder holder) {
   bool r_app = holder.flags & REDIRECT_APPEND; // This can only be true if r_out
                                                // is true
 
-  // create a new pipe
-  pipe(pipes[cur_pipe]);
-
   // fork the process
   pid_t pid = fork();
   // push the pid of the child process to the current job queue (occurs in parent & child, only matters in parent)
@@ -542,18 +611,15 @@ void create_process(CommandHolder holder) {
     // setup pipes
     if(p_in){
       // redirect input to this process from the previous pipe
-      dup2(pipes[old_pipe][0], STDIN_FILENO);
+      dup2(pipes[index-1][0], STDIN_FILENO);
     }
     if(p_out){
       // redirect output of this process to the next pipe
-      dup2(pipes[cur_pipe][1], STDOUT_FILENO);
+      dup2(pipes[index][1], STDOUT_FILENO);
     }
 
-    // close pipes
-    close(pipes[cur_pipe][0]);
-    close(pipes[cur_pipe][1]);
-    close(pipes[old_pipe][0]);
-    close(pipes[old_pipe][1]);
+    // close pipes - builtins never exec so close-on-exec does not cover them
+    close_pipes();
 
     // setup redirects
     if(r_in){
@@ -581,14 +647,6 @@ void create_process(CommandHolder holder) {
     parent_run_command(holder.cmd); // This should be done in the parent branch of a fork
   }
 
-  // close the old pipe, since it will not be used anymore
-  close(pipes[old_pipe][0]);
-  close(pipes[old_pipe][1]);
-
-  // update which pipe index should be used
-  old_pipe = cur_pipe;
-  cur_pipe = (cur_pipe+1)%2;
-
 }
 
 
@@ -620,18 +678,23 @@ void run_script(CommandHolder* holders) {
     return;
   }
 
-  CommandType type;
+  // count the processes in the job so every pipe between them can be opened up front
+  size_t num_procs = 0;
+  while (get_command_holder_type(holders[num_procs]) != EOC)
+    ++num_procs;
 
-  // initialize old pipe (will not be used, but create_process expected one to exist for all processes)
-  pipe(pipes[old_pipe]);
+  // a job missing any of its pipes cannot be wired up, so it is not started
+  if (!open_pipes(num_procs > 0 ? num_procs - 1 : 0)) {
+    close_pipes();
+    return;
+  }
 
   // Run all commands in the `holder` array
-  for (int i = 0; (type = get_command_holder_type(holders[i])) != EOC; ++i)
-    create_process(holders[i]);
+  for (size_t i = 0; i < num_procs; ++i)
+    create_process(holders[i], i);
 
-  // close old pipe, for posterity
-  close(pipes[old_pipe][0]);
-  close(pipes[old_pipe][1]);
+  // the children hold the only ends of the pipes that are still needed
+  close_pipes();
 
   if (!(holders[0].flags & BACKGROUND)) {
     // process is running in foreground
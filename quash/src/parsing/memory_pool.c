@@ -98,6 +98,10 @@ void initialize_memory_pool(size_t size) {
 void* memory_pool_alloc(size_t size) {
   assert(!is_empty_MemoryPoolDeque(&pool_deq));
 
+  // Every MemoryPool starts on a malloc() boundary, so rounding each request up
+  // to the alignment keeps every returned pointer aligned as well
+  size = (size + MEMORY_POOL_ALIGNMENT - 1) & ~(MEMORY_POOL_ALIGNMENT - 1);
+
   MemoryPool pool = peek_back_MemoryPoolDeque(&pool_deq);
   size_t init_size = peek_front_MemoryPoolDeque(&pool_deq).size;
 
@@ -144,6 +148,44 @@ void destroy_memory_pool() {
   destroy_MemoryPoolDeque(&pool_deq);
 }
 
+// Rewind the memory pool for reuse. If the last round of allocations spilled
+// into chained MemoryPools, they are coalesced into a single MemoryPool large
+// enough to hold all of them so the next round can be served without calling
+// malloc.
+void memory_pool_reset() {
+  assert(!is_empty_MemoryPoolDeque(&pool_deq));
+
+  MemoryPool pool = peek_front_MemoryPoolDeque(&pool_deq);
+
+  if (length_MemoryPoolDeque(&pool_deq) > 1) {
+    size_t high_water = 0;
+    size_t size = pool.size;
+
+    // Total number of bytes handed out across every chained pool
+    while (!is_empty_MemoryPoolDeque(&pool_deq)) {
+      MemoryPool mp = pop_back_MemoryPoolDeque(&pool_deq);
+
+      high_water += mp.next - mp.pool;
+      __destroy_memory_pool(mp);
+    }
+
+    while (size < high_water)
+      size <<= 1;
+
+    pool = __initialize_memory_pool(size);
+
+    if (pool.pool == NULL)
+      // We are running low on memory. Try smaller allocations or exit Quash
+      pool = __low_memory_initialize_memory_pool(1, size);
+
+    push_back_MemoryPoolDeque(&pool_deq, pool);
+  }
+
+  pool.next = pool.pool;
+
+  update_front_MemoryPoolDeque(&pool_deq, pool);
+}
+
 // Simple replacement for strdup() that uses the memory pool rather than malloc
 char* memory_pool_strdup(const char* str) {
   assert(str != NULL);
@@ -20,10 +20,19 @@
 #ifndef SRC_PARSING_MEMORY_POOL_H
 #define SRC_PARSING_MEMORY_POOL_H
 
+#include <stddef.h>
 #include <stdlib.h>
 
 #include "deque.h"
 
+/**
+ * @brief Alignment in bytes of every pointer returned by memory_pool_alloc()
+ *
+ * This matches the guarantee made by malloc() so any type may be stored in the
+ * memory pool.
+ */
+#define MEMORY_POOL_ALIGNMENT (_Alignof(max_align_t))
+
 /**
  * @brief Allocate the memory pool
  *
@@ -40,7 +49,8 @@ void initialize_memory_pool(size_t size);
  *
  * @param size Size in bytes of the requested reserved space
  *
- * @return A pointer to a unique array of size bytes
+ * @return A pointer to a unique array of size bytes aligned to @a
+ * MEMORY_POOL_ALIGNMENT
  */
 void* memory_pool_alloc(size_t size);
 
@@ -49,6 +59,22 @@ void* memory_pool_alloc(size_t size);
  */
 void destroy_memory_pool();
 
+/**
+ * @brief Invalidate every allocation in the memory pool without returning the
+ * pool itself to the system
+ *
+ * This is a cheaper alternative to calling destroy_memory_pool() followed by
+ * initialize_memory_pool() when the pool is reused for many short lived
+ * parses (e.g. one per line of a script). If the allocations since the last
+ * reset overflowed into additional blocks, they are replaced by a single block
+ * sized to the high-water mark so the same workload will not need to malloc()
+ * again.
+ *
+ * @note Pointers returned by memory_pool_alloc() before this call must not be
+ * used afterwards
+ */
+void memory_pool_reset();
+
 /**
  * @brief A version of strdup() that allocates the duplicate to the memory pool
  * rather than with malloc directly
@@ -78,10 +104,10 @@ char* memory_pool_strdup(const char* str);
   struct_name new_##struct_name(size_t init_cap) {                      \
     struct_name ret;                                                    \
                                                                         \
-    if (init_cap > 0)                                                   \
-      ret.cap = init_cap;                                               \
-    else                                                                \
-      ret.cap = 1;                                                      \
+    /* Round the capacity up to a power of two */                       \
+    ret.cap = 1;                                                        \
+    while (ret.cap < init_cap)                                          \
+      ret.cap <<= 1;                                                    \
                                                                         \
     ret.data = (type*) memory_pool_alloc(ret.cap * sizeof(type));       \
                                                                         \
@@ -118,201 +144,41 @@ char* memory_pool_strdup(const char* str);
     deq->front = deq->back = 0;                                         \
   }                                                                     \
                                                                         \
-  void empty_##struct_name(struct_name* deq) {                          \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-                                                                        \
-    if (deq->destructor != NULL)                                        \
-      apply_##struct_name(deq, deq->destructor);                        \
-                                                                        \
-    deq->front = deq->back = 0;                                         \
-  }                                                                     \
-                                                                        \
-  bool is_empty_##struct_name(struct_name* deq) {                       \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    return deq->front == deq->back;                                     \
-  }                                                                     \
-                                                                        \
-  size_t length_##struct_name(struct_name* deq) {                       \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    return (deq->back - deq->front + deq->cap) % deq->cap;              \
-  }                                                                     \
-                                                                        \
-  static void __reallign_##struct_name(struct_name* deq) {              \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-                                                                        \
-    if (deq->front != 0) {                                              \
-      type* old_data = deq->data;                                       \
-      size_t len = length_##struct_name(deq);                           \
-                                                                        \
-      deq->data = (type*) memory_pool_alloc(deq->cap * sizeof(type));   \
-                                                                        \
-      if (deq->data == NULL) {                                          \
-        fprintf(stderr, "ERROR: Failed to reallocate struct_name"       \
-                " contents");                                           \
-        abort();                                                        \
-      }                                                                 \
-                                                                        \
-      size_t i;                                                         \
-                                                                        \
-      for (i = 0; i < len; ++i)                                         \
-        deq->data[i] = old_data[(deq->front + i) % deq->cap];           \
-                                                                        \
-      deq->front = 0;                                                   \
-      deq->back = i;                                                    \
-    }                                                                   \
-  }                                                                     \
-                                                                        \
-  type* as_array_##struct_name(struct_name* deq, size_t* len) {         \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-                                                                        \
-    __reallign_##struct_name(deq);                                      \
-                                                                        \
-    type* ret = deq->data;                                              \
-                                                                        \
-    if (len != NULL)                                                    \
-      *len = length_##struct_name(deq);                                 \
-                                                                        \
-    deq->data = NULL;                                                   \
-    deq->cap = deq->front = deq->back = 0;                              \
-                                                                        \
-    return ret;                                                         \
-  }                                                                     \
-                                                                        \
-  void apply_##struct_name(struct_name* deq, void (*func)(type)) {      \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-                                                                        \
-    size_t len = length_##struct_name(deq);                             \
-                                                                        \
-    for (size_t i = 0; i < len; ++i) {                                  \
-      func(deq->data[(deq->front + i) % deq->cap]);                     \
-    }                                                                   \
-  }                                                                     \
-                                                                        \
-  static void __on_push_##struct_name(struct_name* deq) {               \
-    if (deq->front == (deq->back + 1) % deq->cap) {                     \
-      type* old_data = deq->data;                                       \
-      size_t old_cap = deq->cap;                                        \
+  static void __reserve_##struct_name(struct_name* deq, size_t n) {     \
+    size_t len = (deq->back - deq->front) & (deq->cap - 1);             \
                                                                         \
-      deq->cap = 2 * deq->cap;                                          \
-      deq->data = (type*) memory_pool_alloc(deq->cap * sizeof(type));   \
+    /* One slot stays open to tell a full ring from an empty one */     \
+    if (len + n < deq->cap)                                             \
+      return;                                                           \
                                                                         \
-      if (deq->data == NULL) {                                          \
-        fprintf(stderr, "ERROR: Failed to reallocate struct_name"       \
-                " contents\n");                                         \
-        abort();                                                        \
-      }                                                                 \
+    type* old_data = deq->data;                                         \
+    size_t old_cap = deq->cap;                                          \
                                                                         \
-      size_t i;                                                         \
+    while (len + n >= deq->cap)                                         \
+      deq->cap <<= 1;                                                   \
                                                                         \
-      for (i = 0; i < old_cap - 1; ++i)                                 \
-        deq->data[i] = old_data[(deq->front + i) % old_cap];            \
+    deq->data = (type*) memory_pool_alloc(deq->cap * sizeof(type));     \
                                                                         \
-      deq->front = 0;                                                   \
-      deq->back = i;                                                    \
-    }                                                                   \
-  }                                                                     \
-                                                                        \
-  static void __on_pop_##struct_name(struct_name* deq) {                \
-    if (is_empty_##struct_name(deq)) {                                  \
-      fprintf(stderr, "ERROR: Cannot pop from of struct_name while it " \
-              "is empty\n");                                            \
+    if (deq->data == NULL) {                                            \
+      fprintf(stderr, "ERROR: Failed to reallocate struct_name"         \
+              " contents\n");                                           \
       abort();                                                          \
     }                                                                   \
-  }                                                                     \
                                                                         \
-  void push_front_##struct_name(struct_name* deq, type element) {       \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    __on_push_##struct_name(deq);                                       \
-    deq->front = (deq->front + deq->cap - 1) % deq->cap;                \
-    deq->data[deq->front] = element;                                    \
-  }                                                                     \
+    /* Copy the run from front to the end of the old array and then */  \
+    /* the run that wrapped around to its start, if any */              \
+    size_t tail = old_cap - deq->front;                                 \
                                                                         \
-  void push_back_##struct_name(struct_name* deq, type element) {        \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    __on_push_##struct_name(deq);                                       \
-    deq->data[deq->back] = element;                                     \
-    deq->back = (deq->back + 1) % deq->cap;                             \
-  }                                                                     \
+    if (tail > len)                                                     \
+      tail = len;                                                       \
                                                                         \
-  type pop_front_##struct_name(struct_name* deq) {                      \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    __on_pop_##struct_name(deq);                                        \
-    size_t old_front = deq->front;                                      \
-    deq->front = (deq->front + 1) % deq->cap;                           \
-    return deq->data[old_front];                                        \
-  }                                                                     \
+    memcpy(deq->data, old_data + deq->front, tail * sizeof(type));      \
+    memcpy(deq->data + tail, old_data, (len - tail) * sizeof(type));    \
                                                                         \
-  type pop_back_##struct_name(struct_name* deq) {                       \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    __on_pop_##struct_name(deq);                                        \
-    deq->back = (deq->back + deq->cap - 1) % deq->cap;                  \
-    return deq->data[deq->back];                                        \
-  }                                                                     \
-                                                                        \
-  type peek_front_##struct_name(struct_name* deq) {                     \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    assert(!is_empty_##struct_name(deq));                               \
-    return deq->data[deq->front];                                       \
+    deq->front = 0;                                                     \
+    deq->back = len;                                                    \
   }                                                                     \
                                                                         \
-  type peek_back_##struct_name(struct_name* deq) {                      \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    assert(!is_empty_##struct_name(deq));                               \
-    return deq->data[(deq->back + deq->cap - 1) % deq->cap];            \
-  }                                                                     \
-                                                                        \
-  void update_front_##struct_name(struct_name* deq, type element) {     \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    assert(!is_empty_##struct_name(deq));                               \
-    deq->data[deq->front] = element;                                    \
-  }                                                                     \
-                                                                        \
-  void update_back_##struct_name(struct_name* deq, type element) {      \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    assert(!is_empty_##struct_name(deq));                               \
-    deq->data[(deq->back + deq->cap - 1) % deq->cap] = element;         \
-  }                                                                     \
-                                                                        \
-  void update_and_destroy_front_##struct_name(struct_name* deq,         \
-                                              type element) {           \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    assert(!is_empty_##struct_name(deq));                               \
-                                                                        \
-    size_t idx = deq->front;                                            \
-                                                                        \
-    if (deq->destructor != NULL)                                        \
-      deq->destructor(deq->data[idx]);                                  \
-                                                                        \
-    deq->data[idx] = element;                                           \
-  }                                                                     \
-                                                                        \
-  void update_and_destroy_back_##struct_name(struct_name* deq,          \
-                                             type element) {            \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    assert(!is_empty_##struct_name(deq));                               \
-                                                                        \
-    size_t idx = (deq->back + deq->cap - 1) % deq->cap;                 \
-                                                                        \
-    if (deq->destructor != NULL)                                        \
-      deq->destructor(deq->data[idx]);                                  \
-                                                                        \
-    deq->data[idx] = element;                                           \
-  }
+  IMPLEMENT_DEQUE_COMMON(struct_name, type)
 
 #endif
@@ -1,8 +1,12 @@
 #include "parsing_interface.h"
 
 #include <ctype.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "memory_pool.h"
 #include "parse.tab.h"
@@ -17,7 +21,15 @@ IMPLEMENT_DEQUE_MEMORY_POOL(MPStrBuilder, char);
 IMPLEMENT_DEQUE_MEMORY_POOL(CmdStrs, char*);
 IMPLEMENT_DEQUE_MEMORY_POOL(Cmds, CommandHolder);
 
+typedef struct yy_buffer_state* YY_BUFFER_STATE;
+
 extern void destroy_lex();
+extern YY_BUFFER_STATE yy_scan_buffer(char*, size_t);
+extern void yy_delete_buffer(YY_BUFFER_STATE);
+
+static char* script_map = NULL;          // Mapping of the script file, if any
+static size_t script_map_len = 0;        // Length of script_map in bytes
+static YY_BUFFER_STATE script_buf = NULL; // Lexer buffer over script_map
 
 // Generate a string based off of a pipable generic command
 static inline void __stringify_generic_cmd(GenericCommand cmd, CmdStrs* strs) {
@@ -177,41 +189,52 @@ static inline bool __is_identifier_char(char c) {
   return isalnum(c) || c == '_';
 }
 
-// Expand an environment variable onto a string
-static void __interpret_deref(MPStrBuilder* bld, const char* str, int* idx) {
+// Identifiers shorter than this are copied to the stack when looking up an
+// environment variable rather than to the heap
+#define SMALL_ID_SIZE (64)
+
+// Expand an environment variable onto a string. On return idx is the index of
+// the first character after the identifier.
+static void __interpret_deref(MPStrBuilder* bld, const char* str, size_t* idx) {
   assert(str != NULL);
   assert(str[*idx] == '$');
-  assert(peek_back_MPStrBuilder(bld) == '$');
-
-  // Remove the dereference symbol at the back of the bld deque
-  pop_back_MPStrBuilder(bld);
-
-  StrBuilder tmp = new_StrBuilder(16);
-  char c;
 
-  // Extract the identifier characters. Since this is intended only as a helper
+  // Find the end of the identifier. Since this is intended only as a helper
   // function we assume that interpret_complex_string token has already noticed
   // a valid first identifier character after the dereference symbol.
-  while (__is_identifier_char((c = str[++(*idx)])))
-    push_back_StrBuilder(&tmp, c);
+  const char* id_start = str + *idx + 1;
+  size_t id_len = 1;
 
-  // idx increments one too far in the while loop so bring it back down
-  --(*idx);
+  while (__is_identifier_char(id_start[id_len]))
+    ++id_len;
 
-  // Add the null terminator to the string
-  push_back_StrBuilder(&tmp, '\0');
+  *idx += id_len + 1;
+
+  // Null terminate a copy of the identifier. Typical identifiers fit on the
+  // stack. Only unusually long ones need a heap allocation.
+  char small_id[SMALL_ID_SIZE];
+  char* id = small_id;
+
+  if (id_len < SMALL_ID_SIZE) {
+    memcpy(small_id, id_start, id_len);
+    small_id[id_len] = '\0';
+  }
+  else {
+    StrBuilder tmp = new_StrBuilder(id_len + 1);
+
+    push_back_n_StrBuilder(&tmp, id_start, id_len);
+    push_back_StrBuilder(&tmp, '\0');
+    id = as_array_StrBuilder(&tmp, NULL);
+  }
 
-  // Extract the id string and lookup the environment variable
-  char* id = as_array_StrBuilder(&tmp, NULL);
   const char* env_var = lookup_env(id);
 
-  free(id);
+  if (id != small_id)
+    free(id);
 
   // Append env_var to the string builder
-  if (env_var != NULL) {
-    for (int i = 0; env_var[i] != '\0'; ++i)
-      push_back_MPStrBuilder(bld, env_var[i]);
-  }
+  if (env_var != NULL)
+    push_back_n_MPStrBuilder(bld, env_var, strlen(env_var));
 }
 
 // Cleans up escapes and unescaped single quotes and expands environment
@@ -220,12 +243,19 @@ char* interpret_complex_string_token(const char* str) {
   assert(str != NULL);
 
   MPStrBuilder bld = new_MPStrBuilder(64);
-  int i;
-  int len = strlen(str);
+  size_t i = 0;
   bool in_quotes = false;
 
-  for (i = 0; i <= len; ++i) {
-    push_back_MPStrBuilder(&bld, str[i]);
+  while (true) {
+    // Copy everything up to the next character that needs interpreting in one
+    // go
+    size_t run = strcspn(str + i, "\\'$");
+
+    push_back_n_MPStrBuilder(&bld, str + i, run);
+    i += run;
+
+    if (str[i] == '\0')
+      break;
 
     switch (str[i]) {
     case '\\':                // Remove valid escape characters
@@ -241,32 +271,38 @@ char* interpret_complex_string_token(const char* str) {
         case ';':
         case ' ':
         case '\t':
-          update_back_MPStrBuilder(&bld, str[++i]);
+          push_back_MPStrBuilder(&bld, str[i+1]);
+          i += 2;
           break;
 
         case '\n':
-          pop_back_MPStrBuilder(&bld);
-          ++i;
+          i += 2;
           break;
 
         default:
+          push_back_MPStrBuilder(&bld, str[i++]);
           break;
         }
       }
       else if (str[i+1] == '\'') {
-        update_back_MPStrBuilder(&bld, '\'');
-        ++i;
+        push_back_MPStrBuilder(&bld, '\'');
+        i += 2;
+      }
+      else {
+        push_back_MPStrBuilder(&bld, str[i++]);
       }
       break;
 
     case '\'':                // Remove single quotes and toggle quote state
       in_quotes = !in_quotes;
-      pop_back_MPStrBuilder(&bld);
+      ++i;
       break;
 
     case '$':                 // Try to dereference environment variables
       if (!in_quotes && __is_first_identifier_char(str[i + 1]))
         __interpret_deref(&bld, str, &i);
+      else
+        push_back_MPStrBuilder(&bld, str[i++]);
       break;
 
     default:
@@ -275,7 +311,7 @@ char* interpret_complex_string_token(const char* str) {
   }
 
   // Add a null terminator
-  update_back_MPStrBuilder(&bld, '\0');
+  push_back_MPStrBuilder(&bld, '\0');
 
   assert(!in_quotes);
 
@@ -308,7 +344,68 @@ CommandHolder* parse(QuashState* state) {
   return holders;
 }
 
+// Map a script file into memory and point the lexer at it
+bool open_script_file(const char* path) {
+  assert(path != NULL);
+  assert(script_map == NULL);
+
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+
+  if (fd < 0)
+    return false;
+
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return false;
+  }
+
+  // The lexer requires two null bytes after the end of the buffer. Reserve
+  // zero filled pages large enough for the file plus the terminators and then
+  // map the file over the front of them. Anything past the end of the file
+  // reads back as zero.
+  size_t size = st.st_size;
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t len = (size + 2 + page - 1) / page * page;
+
+  char* base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (base == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  // The lexer writes into its buffer so the mapping must be private and
+  // writable
+  if (size > 0 && mmap(base, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(base, len);
+    close(fd);
+    return false;
+  }
+
+  close(fd);
+  madvise(base, len, MADV_SEQUENTIAL);
+
+  script_map = base;
+  script_map_len = len;
+  script_buf = yy_scan_buffer(script_map, size + 2);
+
+  return script_buf != NULL;
+}
+
 // Clean up dynamically allocated memory in the parser
 void destroy_parser() {
+  if (script_buf != NULL) {
+    yy_delete_buffer(script_buf);
+    script_buf = NULL;
+  }
+
+  if (script_map != NULL) {
+    munmap(script_map, script_map_len);
+    script_map = NULL;
+  }
+
   destroy_lex();
 }
@@ -99,6 +99,20 @@ char* interpret_complex_string_token(const char* str);
  */
 CommandHolder* parse(QuashState* state);
 
+/**
+ * @brief Make the parser read commands from a script file instead of standard
+ * in
+ *
+ * The whole file is mapped into memory and handed to the lexer as a single
+ * buffer, so no further reads are issued while the script is parsed.
+ *
+ * @param path Path to the script file
+ *
+ * @return True if the file was mapped successfully, false otherwise with errno
+ * set appropriately
+ */
+bool open_script_file(const char* path);
+
 /**
  * @brief Cleanup memory dynamically allocated by the parser
  */
@@ -9,9 +9,12 @@
  **************************************************************************/
 #include "quash.h"
 
+#include <errno.h>
+#include <getopt.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdio.h>
 
@@ -75,6 +78,22 @@ static void print_prompt() {
     free(cwd);
 }
 
+// Print the command line usage of quash
+static void print_usage(const char* prog, FILE* out) {
+  fprintf(out, "Usage: %s [-f script]\n", prog);
+  fprintf(out, "\t-f script  Run the commands in script rather than reading "
+          "standard in\n");
+}
+
+// Seconds elapsed on the monotonic clock since start
+static double seconds_since(const struct timespec* start) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
 /**************************************************************************
  * Public Functions
  **************************************************************************/
@@ -108,8 +127,34 @@ void end_main_loop() {
  * @return program exit status
  */
 int main(int argc, char** argv) {
+  const char* script = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "f:")) != -1) {
+    switch (opt) {
+    case 'f':
+      script = optarg;
+      break;
+
+    default:
+      print_usage(argv[0], stderr);
+      return EXIT_FAILURE;
+    }
+  }
+
   state = initial_state();
 
+  if (script != NULL) {
+    // Batch mode: commands come from the script and nothing is interactive
+    if (!open_script_file(script)) {
+      fprintf(stderr, "ERROR: Failed to open script %s: %s\n", script,
+              strerror(errno));
+      return EXIT_FAILURE;
+    }
+
+    state.is_a_tty = false;
+  }
+
   if (is_tty()) {
     puts("Welcome to Quash!");
     puts("Type \"exit\" or \"quit\" to quit");
@@ -120,18 +165,38 @@ int main(int argc, char** argv) {
   atexit(destroy_parser);
   atexit(destroy_memory_pool);
 
+  struct timespec start;
+  size_t lines = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // A single memory pool is shared by every line. It is reset rather than
+  // destroyed after each command so parsing a long script does not keep
+  // returning the pool to the system only to allocate it again.
+  initialize_memory_pool(1024);
+
   // Main execution loop
   while (is_running()) {
     if (is_tty())
       print_prompt();
 
-    initialize_memory_pool(1024);
-    CommandHolder* script = parse(&state);
+    CommandHolder* holders = parse(&state);
+
+    if (holders != NULL)
+      run_script(holders);
+
+    memory_pool_reset();
+
+    // Do not count the final read that only found the end of the input
+    if (holders != NULL || is_running())
+      ++lines;
+  }
 
-    if (script != NULL)
-      run_script(script);
+  if (script != NULL) {
+    double elapsed = seconds_since(&start);
 
-    destroy_memory_pool();
+    fprintf(stderr, "quash: %zu lines in %.3f s (%.0f lines/sec)\n", lines,
+            elapsed, elapsed > 0 ? lines / elapsed : 0.0);
   }
 
   return EXIT_SUCCESS;